@@ -0,0 +1,93 @@
+#ifndef WORDLANG_ALLOC_COUNTER_HPP_INCLUDE_
+#define WORDLANG_ALLOC_COUNTER_HPP_INCLUDE_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Counts bytes requested through the global operator new, for profiling.  While
+// counting is off, an allocation only pays for one relaxed load of a flag.
+//
+// This header replaces the global allocation operators, so it must be included
+// by exactly one translation unit (WordLang.cpp).
+namespace alloc_counter {
+  inline std::atomic<bool> enabled{false};
+  inline std::atomic<uint64_t> total_bytes{0};
+  inline std::atomic<uint64_t> total_allocs{0};
+
+  inline void Enable(bool in=true) { enabled.store(in, std::memory_order_relaxed); }
+  inline uint64_t GetBytes() { return total_bytes.load(std::memory_order_relaxed); }
+  inline uint64_t GetAllocs() { return total_allocs.load(std::memory_order_relaxed); }
+
+  inline void Count(size_t size) {
+    if (enabled.load(std::memory_order_relaxed)) {
+      total_bytes.fetch_add(size, std::memory_order_relaxed);
+      total_allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // nullptr if there is no memory (for the nothrow forms)...
+  inline void * TryAllocate(size_t size) noexcept {
+    Count(size);
+    return std::malloc(size ? size : 1);
+  }
+
+  inline void * TryAllocateAligned(size_t size, std::align_val_t align) noexcept {
+    Count(size);
+    const size_t alignment = static_cast<size_t>(align);
+    size = (size + alignment - 1) / alignment * alignment;    // aligned_alloc needs a multiple.
+    return std::aligned_alloc(alignment, size ? size : alignment);
+  }
+
+  // ...or std::bad_alloc.
+  inline void * Allocate(size_t size) {
+    void * ptr = TryAllocate(size);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+  }
+
+  inline void * AllocateAligned(size_t size, std::align_val_t align) {
+    void * ptr = TryAllocateAligned(size, align);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+  }
+}
+
+// Every form is replaced, so that whatever the library allocates (such as the
+// nothrow buffer of std::stable_sort) is counted and freed by the same malloc.
+
+void * operator new(size_t size) { return alloc_counter::Allocate(size); }
+void * operator new[](size_t size) { return alloc_counter::Allocate(size); }
+void * operator new(size_t size, std::align_val_t align) {
+  return alloc_counter::AllocateAligned(size, align);
+}
+void * operator new[](size_t size, std::align_val_t align) {
+  return alloc_counter::AllocateAligned(size, align);
+}
+void * operator new(size_t size, const std::nothrow_t &) noexcept {
+  return alloc_counter::TryAllocate(size);
+}
+void * operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return alloc_counter::TryAllocate(size);
+}
+void * operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+  return alloc_counter::TryAllocateAligned(size, align);
+}
+void * operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+  return alloc_counter::TryAllocateAligned(size, align);
+}
+void operator delete(void * ptr) noexcept { std::free(ptr); }
+void operator delete[](void * ptr) noexcept { std::free(ptr); }
+void operator delete(void * ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void * ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void * ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void * ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void * ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void * ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void * ptr, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete[](void * ptr, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete(void * ptr, std::align_val_t, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete[](void * ptr, std::align_val_t, const std::nothrow_t &) noexcept { std::free(ptr); }
+
+#endif // #ifndef WORDLANG_ALLOC_COUNTER_HPP_INCLUDE_
@@ -0,0 +1,71 @@
+#ifndef WORDLANG_EXPR_CACHE_HPP_INCLUDE_
+#define WORDLANG_EXPR_CACHE_HPP_INCLUDE_
+
+#include <assert.h>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "WordSet.hpp"
+
+// Results of expressions that occur more than once in a script.  Each slot is
+// one group of identical pure expressions and remembers its last value along
+// with the versions of the variables it read; a lookup hits only when none of
+// those variables has been assigned since.  Statements that run at the same
+// time never share a slot or a variable one of them assigns (see
+// WordLang::PlanStatements()), so they can use one cache.
+class ExprCache {
+private:
+  struct Slot {
+    std::vector<size_t> vars{};           // Variables the expression reads.
+    std::vector<uint64_t> versions{};     // Their versions when value was computed.
+    WordSet value{};
+    bool valid = false;
+  };
+
+  std::vector<Slot> slots{};
+  std::vector<uint64_t> var_versions{};
+  std::atomic<size_t> num_hits{0};      // Counted from every thread using the cache.
+  std::atomic<size_t> num_misses{0};
+
+public:
+  // Start a new run; slot_vars[i] lists the variables read by slot i.
+  void Reset(size_t num_vars, const std::vector<std::vector<size_t>> & slot_vars) {
+    var_versions.assign(num_vars, 0);
+    slots.assign(slot_vars.size(), Slot{});
+    for (size_t i = 0; i < slot_vars.size(); ++i) {
+      slots[i].vars = slot_vars[i];
+      slots[i].versions.resize(slot_vars[i].size());
+    }
+    num_hits = num_misses = 0;
+  }
+
+  void NoteAssign(size_t var_id) {
+    assert(var_id < var_versions.size());
+    ++var_versions[var_id];
+  }
+
+  // The cached value of a slot, or nullptr if it must be recomputed.
+  const WordSet * Find(size_t slot_id) {
+    const Slot & slot = slots[slot_id];
+    bool current = slot.valid;
+    for (size_t i = 0; current && i < slot.vars.size(); ++i) {
+      current = slot.versions[i] == var_versions[slot.vars[i]];
+    }
+    (current ? num_hits : num_misses).fetch_add(1, std::memory_order_relaxed);
+    return current ? &slot.value : nullptr;
+  }
+
+  void Store(size_t slot_id, WordSet value) {
+    Slot & slot = slots[slot_id];
+    for (size_t i = 0; i < slot.vars.size(); ++i) slot.versions[i] = var_versions[slot.vars[i]];
+    slot.value = std::move(value);
+    slot.valid = true;
+  }
+
+  size_t GetNumSlots() const { return slots.size(); }
+  size_t GetNumHits() const { return num_hits; }
+  size_t GetNumMisses() const { return num_misses; }
+};
+
+#endif // #ifndef WORDLANG_EXPR_CACHE_HPP_INCLUDE_
@@ -0,0 +1,188 @@
+#ifndef WORDLANG_FILTER_ENGINE_HPP_INCLUDE_
+#define WORDLANG_FILTER_ENGINE_HPP_INCLUDE_
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Answers "does this word contain any of the needles?" for a fixed needle list.
+// The list is compiled once: a handful of needles are searched directly with a
+// SIMD first/last-byte scan, while larger lists become an Aho-Corasick automaton
+// so that each word is scanned in a single pass regardless of needle count.
+class FilterEngine {
+private:
+  static constexpr size_t MAX_DIRECT_NEEDLES = 8;
+
+  enum class Mode { NEVER, ALWAYS, DIRECT, AUTOMATON };
+  Mode mode = Mode::NEVER;
+
+  std::vector<std::string> needles{};        // Used in DIRECT mode.
+
+  // Aho-Corasick DFA.  Bytes are remapped to classes (bytes that appear in no
+  // needle share class 0) so the table is num_states x num_classes.
+  std::array<uint16_t, 256> byte_class{};
+  size_t num_classes = 1;
+  std::vector<uint32_t> next_state{};        // [state * num_classes + class]
+  std::vector<uint8_t> is_match{};           // Does reaching state mean a hit?
+
+  static bool HasNeedle(std::string_view word, std::string_view needle) {
+    const size_t size = needle.size();
+    if (size > word.size()) return false;
+    if (size == 1) return std::memchr(word.data(), needle[0], word.size()) != nullptr;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[size - 1]);
+    const size_t num_starts = word.size() - size + 1;  // Candidate start positions.
+    size_t pos = 0;
+    char buffer[32];
+    for (; pos < num_starts; pos += 16) {
+      // Near the end, copy to a buffer rather than read past the word.
+      const char * block = word.data() + pos;
+      if (pos + size - 1 + 16 > word.size()) {
+        if (size + 15 > sizeof(buffer)) return word.find(needle, pos) != std::string_view::npos;
+        const size_t left = word.size() - pos;
+        std::memset(buffer, 0, sizeof(buffer));
+        std::memcpy(buffer, block, std::min(left, sizeof(buffer)));
+        block = buffer;
+      }
+      const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+      const __m128i block_last =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + size - 1));
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last))));
+      if (num_starts - pos < 16) mask &= (1u << (num_starts - pos)) - 1;
+      while (mask) {
+        const size_t offset = pos + static_cast<size_t>(std::countr_zero(mask));
+        if (std::memcmp(word.data() + offset + 1, needle.data() + 1, size - 2) == 0) return true;
+        mask &= mask - 1;
+      }
+    }
+    return false;
+#else
+    return word.find(needle) != std::string_view::npos;
+#endif
+  }
+
+  void BuildAutomaton(const std::vector<std::string_view> & in_needles) {
+    for (std::string_view needle : in_needles) {
+      for (char c : needle) {
+        uint16_t & id = byte_class[static_cast<uint8_t>(c)];
+        if (id == 0) id = static_cast<uint16_t>(num_classes++);
+      }
+    }
+
+    // Build the trie; state 0 is the root.
+    std::vector<uint32_t> trie(num_classes, 0);
+    is_match.assign(1, 0);
+    for (std::string_view needle : in_needles) {
+      uint32_t state = 0;
+      for (char c : needle) {
+        const size_t slot = state * num_classes + byte_class[static_cast<uint8_t>(c)];
+        if (trie[slot] == 0) {
+          trie[slot] = static_cast<uint32_t>(is_match.size());
+          is_match.push_back(0);
+          trie.resize(trie.size() + num_classes, 0);
+        }
+        state = trie[slot];
+      }
+      is_match[state] = 1;
+    }
+
+    // Breadth-first pass turns trie edges plus failure links into a full DFA.
+    next_state = std::move(trie);
+    std::vector<uint32_t> fail(is_match.size(), 0);
+    std::vector<uint32_t> queue;
+    for (size_t c = 0; c < num_classes; ++c) {
+      if (next_state[c]) queue.push_back(next_state[c]);
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+      const uint32_t state = queue[head];
+      is_match[state] |= is_match[fail[state]];
+      for (size_t c = 0; c < num_classes; ++c) {
+        uint32_t & child = next_state[state * num_classes + c];
+        const uint32_t fallback = next_state[fail[state] * num_classes + c];
+        if (child) {
+          fail[child] = fallback;
+          queue.push_back(child);
+        } else {
+          child = fallback;
+        }
+      }
+    }
+  }
+
+  bool RunAutomaton(std::string_view word) const {
+    uint32_t state = 0;
+    for (char c : word) {
+      state = next_state[state * num_classes + byte_class[static_cast<uint8_t>(c)]];
+      if (is_match[state]) return true;
+    }
+    return false;
+  }
+
+public:
+  explicit FilterEngine(std::vector<std::string_view> in_needles) {
+    if (in_needles.empty()) return;                   // Nothing can match.
+    for (std::string_view needle : in_needles) {
+      if (needle.empty()) { mode = Mode::ALWAYS; return; }
+    }
+
+    // A needle that contains another needle is redundant.  Pruning is quadratic,
+    // so only bother for lists short enough that it may enable DIRECT mode.
+    std::vector<std::string_view> kept;
+    if (in_needles.size() > MAX_DIRECT_NEEDLES * 16) kept = std::move(in_needles);
+    else {
+      std::sort(in_needles.begin(), in_needles.end(),
+                [](std::string_view a, std::string_view b){ return a.size() < b.size(); });
+      for (std::string_view needle : in_needles) {
+        bool redundant = false;
+        for (std::string_view shorter : kept) {
+          if (needle.find(shorter) != std::string_view::npos) { redundant = true; break; }
+        }
+        if (!redundant) kept.push_back(needle);
+      }
+    }
+
+    if (kept.size() <= MAX_DIRECT_NEEDLES) {
+      mode = Mode::DIRECT;
+      needles.assign(kept.begin(), kept.end());
+    } else {
+      mode = Mode::AUTOMATON;
+      BuildAutomaton(kept);
+    }
+  }
+
+  bool MatchesAll() const { return mode == Mode::ALWAYS; }
+  bool MatchesNone() const { return mode == Mode::NEVER; }
+
+  // The needles, if they are searched for one at a time (nullptr if not).
+  const std::vector<std::string> * GetDirectNeedles() const {
+    return mode == Mode::DIRECT ? &needles : nullptr;
+  }
+
+  // Does word contain at least one of the needles?
+  bool Matches(std::string_view word) const {
+    switch (mode) {
+    case Mode::NEVER: return false;
+    case Mode::ALWAYS: return true;
+    case Mode::DIRECT:
+      for (const std::string & needle : needles) {
+        if (HasNeedle(word, needle)) return true;
+      }
+      return false;
+    case Mode::AUTOMATON: return RunAutomaton(word);
+    }
+    return false;
+  }
+};
+
+#endif // #ifndef WORDLANG_FILTER_ENGINE_HPP_INCLUDE_
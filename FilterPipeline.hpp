@@ -0,0 +1,133 @@
+#ifndef WORDLANG_FILTER_PIPELINE_HPP_INCLUDE_
+#define WORDLANG_FILTER_PIPELINE_HPP_INCLUDE_
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+#include "FilterEngine.hpp"
+#include "PackedWords.hpp"
+#include "SubstringIndex.hpp"
+#include "ThreadPool.hpp"
+#include "WordLoader.hpp"
+#include "WordSet.hpp"
+
+// A chain of filter / filter_out stages fused into a single predicate, so that
+// "x | filter(a) | filter_out(b) | ..." makes one pass over x and never builds
+// the intermediate sets.
+class FilterPipeline {
+private:
+  struct Stage {
+    FilterEngine engine;
+    std::vector<std::string_view> needles;    // For lookups in a SubstringIndex.
+    bool filter_out;
+  };
+  std::vector<Stage> stages{};
+  bool rejects_all = false;     // Some stage can never pass.
+
+public:
+  // Stages run in the order they are added.
+  void AddStage(std::vector<std::string_view> needles, bool filter_out) {
+    FilterEngine engine(needles);
+    // Stages that pass every word can simply be dropped.
+    if (filter_out ? engine.MatchesNone() : engine.MatchesAll()) return;
+    if (filter_out ? engine.MatchesAll() : engine.MatchesNone()) rejects_all = true;
+    stages.push_back(Stage{std::move(engine), std::move(needles), filter_out});
+  }
+
+  // Could some stage be looked up in a SubstringIndex (see RunIndexed())?
+  bool CanUseIndex() const {
+    return std::any_of(stages.begin(), stages.end(), [](const Stage & stage){
+      return std::all_of(stage.needles.begin(), stage.needles.end(), SubstringIndex::CanFind);
+    });
+  }
+
+  // Could every stage run on packed words (see RunPacked())?
+  bool CanUsePacked() const {
+    return std::all_of(stages.begin(), stages.end(), [](const Stage & stage){
+      return stage.engine.GetDirectNeedles() != nullptr;
+    });
+  }
+
+  bool Test(std::string_view word) const {
+    for (const Stage & stage : stages) {
+      if (stage.engine.Matches(word) == stage.filter_out) return false;
+    }
+    return true;
+  }
+
+  WordSet Run(const WordSet & words, ThreadPool & pool) const {
+    if (rejects_all) return WordSet{};
+    if (stages.empty()) return words;
+    if (CanUseIndex()) {
+      if (auto index = SubstringIndex::Find(words)) return RunIndexed(*index, words, pool);
+    }
+    if (CanUsePacked()) {
+      if (auto packed = PackedWords::Find(words)) return RunPacked(*packed, pool);
+    }
+    return words.Select([this](std::string_view word){ return Test(word); }, pool);
+  }
+
+  // Test the short words a block at a time: each needle of each stage is one
+  // call of the packed_words kernel, then the stages combine the lanes it found.
+  WordSet RunPacked(const PackedWords & packed, ThreadPool & pool) const {
+    const packed_words::kernel_t kernel = packed_words::GetKernel();
+    auto test_block = [this, kernel](const uint8_t * rows, size_t length){
+      uint32_t pass = ~uint32_t{0};
+      for (const Stage & stage : stages) {
+        uint32_t found = 0;
+        for (const std::string & needle : *stage.engine.GetDirectNeedles()) {
+          if (needle.size() <= length) found |= kernel(rows, length, needle);
+        }
+        pass &= stage.filter_out ? ~found : found;
+        if (!pass) break;
+      }
+      return pass;
+    };
+    return packed.Select(test_block, [this](std::string_view word){ return Test(word); }, pool);
+  }
+
+  // With an index, matches of long enough needles are looked up rather than
+  // scanned for.  A filter() stage that can be looked up yields the only
+  // candidates, which the other stages then test.  Otherwise the matches of each
+  // filter_out() stage that can be looked up are removed, and any remaining
+  // stages are tested on what is left.
+  WordSet RunIndexed(const SubstringIndex & index, const WordSet & words, ThreadPool & pool) const {
+    auto CanFind = [](const Stage & stage){
+      return std::all_of(stage.needles.begin(), stage.needles.end(), SubstringIndex::CanFind);
+    };
+    auto TestExcept = [this](std::vector<bool> skip){
+      return [this, skip](std::string_view word){
+        for (size_t i = 0; i < stages.size(); ++i) {
+          if (!skip[i] && stages[i].engine.Matches(word) == stages[i].filter_out) return false;
+        }
+        return true;
+      };
+    };
+    std::vector<bool> done(stages.size(), false);
+    for (size_t i = 0; i < stages.size(); ++i) {
+      if (stages[i].filter_out || !CanFind(stages[i])) continue;
+      done[i] = true;
+      return index.FindAny(stages[i].needles).Select(TestExcept(done), pool);
+    }
+    WordSet out = words;
+    for (size_t i = 0; i < stages.size(); ++i) {
+      if (!stages[i].filter_out || !CanFind(stages[i])) continue;
+      done[i] = true;
+      out.Remove(index.FindAny(stages[i].needles));
+    }
+    if (std::find(done.begin(), done.end(), false) == done.end()) return out;
+    return out.Select(TestExcept(done), pool);
+  }
+
+  // Run the pipeline over the words of files as they are loaded (the result of
+  // "load(filenames) | ...") without building the loaded set first.
+  WordSet RunOnFiles(const std::vector<std::string_view> & filenames, ThreadPool & pool,
+                     LoadCache * cache=nullptr) const {
+    if (rejects_all) return WordSet{};
+    if (stages.empty()) return LoadWordFiles(filenames, pool, cache);
+    return LoadWordFilesIf(filenames, pool, cache, [this](std::string_view word){ return Test(word); });
+  }
+};
+
+#endif // #ifndef WORDLANG_FILTER_PIPELINE_HPP_INCLUDE_
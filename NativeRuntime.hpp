@@ -0,0 +1,149 @@
+#ifndef WORDLANG_NATIVE_RUNTIME_HPP_INCLUDE_
+#define WORDLANG_NATIVE_RUNTIME_HPP_INCLUDE_
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "FilterPipeline.hpp"
+#include "Output.hpp"
+#include "Snapshot.hpp"
+#include "SubstringIndex.hpp"
+#include "ThreadPool.hpp"
+#include "WordLoader.hpp"
+#include "WordSet.hpp"
+
+// Support code for the C++ programs written by "WordLang --emit-cpp".  They use
+// the interpreter's word sets, loaders and output; what changes is that literal
+// sets are static arrays and filters with literal needles are matchers built at
+// compile time from the needle text.
+namespace native {
+  // Needle text as a template argument: HasAny<"ab", "c">(word).
+  template <size_t N>
+  struct Needle {
+    char text[N]{};
+    constexpr Needle(const char (&in)[N]) { std::copy_n(in, N, text); }
+    constexpr size_t Size() const { return N - 1; }
+  };
+
+  // Does word contain NEEDLE?  The length is a constant, so the comparison
+  // after the first byte is unrolled by the compiler.
+  template <Needle NEEDLE>
+  inline bool Has(std::string_view word) {
+    constexpr size_t SIZE = NEEDLE.Size();
+    if constexpr (SIZE == 0) return true;
+    else if constexpr (SIZE == 1) {
+      return std::memchr(word.data(), NEEDLE.text[0], word.size()) != nullptr;
+    }
+    else {
+      if (word.size() < SIZE) return false;
+      const char * at = word.data();
+      const char * const last = word.data() + word.size() - SIZE;
+      while ((at = static_cast<const char *>(std::memchr(at, NEEDLE.text[0],
+                                                         static_cast<size_t>(last - at) + 1)))) {
+        if (std::memcmp(at + 1, NEEDLE.text + 1, SIZE - 1) == 0) return true;
+        if (at++ == last) return false;
+      }
+      return false;
+    }
+  }
+
+  // Does word contain any of NEEDLES?  A set of single bytes becomes a table.
+  template <Needle... NEEDLES>
+  inline bool HasAny(std::string_view word) {
+    if constexpr (sizeof...(NEEDLES) > 1 && ((NEEDLES.Size() == 1) && ...)) {
+      static constexpr std::array<bool, 256> TABLE = []{
+        std::array<bool, 256> table{};
+        ((table[static_cast<unsigned char>(NEEDLES.text[0])] = true), ...);
+        return table;
+      }();
+      for (char c : word) if (TABLE[static_cast<unsigned char>(c)]) return true;
+      return false;
+    }
+    else return (Has<NEEDLES>(word) || ...);
+  }
+
+  inline WordSet MakeSet(std::span<const std::string_view> words) {
+    WordSetBuilder builder;
+    for (std::string_view word : words) builder.Add(word);
+    return builder.Build();
+  }
+
+  // The same chain as a FilterPipeline, for sets that have a substring index.
+  inline FilterPipeline MakePipeline(
+      std::initializer_list<std::pair<std::span<const std::string_view>, bool>> stages) {
+    FilterPipeline pipeline;
+    for (const auto & [needles, filter_out] : stages) {
+      pipeline.AddStage(std::vector<std::string_view>(needles.begin(), needles.end()), filter_out);
+    }
+    return pipeline;
+  }
+
+  // words | <chain>, where test is the chain's matcher and pipeline is the same
+  // chain, for looking matches up in an index when that helps (see
+  // SubstringIndex::Find()).
+  template <typename FN>
+  WordSet Filter(const WordSet & words, ThreadPool & pool, const FilterPipeline & pipeline, FN test) {
+    if (pipeline.CanUseIndex()) {
+      if (auto index = SubstringIndex::Find(words)) return pipeline.RunIndexed(*index, words, pool);
+    }
+    return words.Select(test, pool);
+  }
+
+  // load(filenames) | <chain>, filtered while the files are read.
+  template <typename FN>
+  WordSet LoadFiltered(const WordSet & filenames, ThreadPool & pool, LoadCache & cache, FN test) {
+    return LoadWordFilesIf(filenames.SortedWords(), pool, &cache, test);
+  }
+
+  // Run a parallel loop the way the VM does: the members are split into parts,
+  // and body(out, begin, end) runs each part on the pool with an output of its
+  // own; the outputs are then written in loop order.
+  template <typename WRITER, typename FN>
+  void ForEachPart(ThreadPool & pool, WRITER & out, const std::vector<WordSet::id_t> & ids, FN body) {
+    constexpr size_t PARTS_PER_THREAD = 4;
+    const size_t num_parts = std::min(ids.size(), pool.GetNumThreads() * PARTS_PER_THREAD);
+    std::vector<StringWriter> outputs(num_parts);
+    pool.ParallelFor(num_parts, [&](size_t part){
+      body(outputs[part], ids.data() + ids.size() * part / num_parts,
+           ids.data() + ids.size() * (part + 1) / num_parts);
+    });
+    for (const StringWriter & part_output : outputs) out.Write(part_output.GetText());
+  }
+
+  // Report a script error as the interpreter does; returns the exit code.
+  inline int Fail(OutputWriter & out, size_t line, const std::string & error) {
+    out.Flush();
+    std::cerr << "ERROR (line " << line << "): " << error << std::endl;
+    return 1;
+  }
+
+  // The number after option on the command line (0 if it is not there).
+  inline size_t NumberOption(int argc, char * argv[], std::string_view option) {
+    for (int i = 1; i + 1 < argc; ++i) {
+      if (std::string_view(argv[i]) == option) return std::strtoul(argv[i + 1], nullptr, 10);
+    }
+    return 0;
+  }
+
+  // Threads to use: "--threads N" on the command line, or one per hardware thread.
+  inline size_t NumThreads(int argc, char * argv[]) {
+    const size_t num_threads = NumberOption(argc, argv, "--threads");
+    return num_threads ? num_threads : ThreadPool::DefaultThreads();
+  }
+
+  // "--spill-budget MB" on the command line, in bytes (see Spill.hpp).
+  inline size_t SpillBudget(int argc, char * argv[]) {
+    return NumberOption(argc, argv, "--spill-budget") << 20;
+  }
+}
+
+#endif // #ifndef WORDLANG_NATIVE_RUNTIME_HPP_INCLUDE_
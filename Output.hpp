@@ -0,0 +1,101 @@
+#ifndef WORDLANG_OUTPUT_HPP_INCLUDE_
+#define WORDLANG_OUTPUT_HPP_INCLUDE_
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <unistd.h>
+
+#include "WordSet.hpp"
+
+// Buffered writer for program output.  Text collects in a large buffer that is
+// handed to the OS with one write() when it fills up (or on Flush()), instead
+// of going through an ostream a few bytes at a time.
+//
+// Output written with std::cout must be flushed before this writer is used, and
+// this writer flushed before std::cout is used again.
+class OutputWriter {
+private:
+  static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+  int fd;
+  std::unique_ptr<char[]> buffer;
+  size_t used = 0;
+
+  void WriteAll(const char * data, size_t size) {
+    while (size) {
+      const ssize_t count = write(fd, data, size);
+      if (count < 0) {
+        if (errno == EINTR) continue;
+        return;                              // Nowhere left to report it.
+      }
+      data += count;
+      size -= static_cast<size_t>(count);
+    }
+  }
+
+public:
+  explicit OutputWriter(int fd) : fd(fd), buffer(std::make_unique<char[]>(BUFFER_SIZE)) { }
+  OutputWriter(const OutputWriter &) = delete;
+  OutputWriter & operator=(const OutputWriter &) = delete;
+  ~OutputWriter() { Flush(); }
+
+  // The writer for standard output; it is flushed again when the program exits.
+  static OutputWriter & Stdout() {
+    static OutputWriter out(STDOUT_FILENO);
+    return out;
+  }
+
+  void Write(std::string_view text) {
+    if (text.size() > BUFFER_SIZE - used) {
+      Flush();
+      if (text.size() >= BUFFER_SIZE) { WriteAll(text.data(), text.size()); return; }
+    }
+    std::memcpy(buffer.get() + used, text.data(), text.size());
+    used += text.size();
+  }
+
+  void Flush() {
+    WriteAll(buffer.get(), used);
+    used = 0;
+  }
+};
+
+// Collects output in memory, for text that has to wait its turn (such as the
+// output of one part of a parallel loop).
+class StringWriter {
+private:
+  std::string text{};
+
+public:
+  void Write(std::string_view in) { text.append(in); }
+  const std::string & GetText() const { return text; }
+  std::string TakeText() { return std::move(text); }
+};
+
+// Print the members of words for which test(word) is true the way print() shows
+// a list: "[,word1,word2 ]", sorted.  Each word is written as soon as it passes,
+// so the selected words never have to be collected into a set.
+template <typename WRITER, typename FN>
+void PrintWordListIf(WRITER & out, const WordSet & words, FN test) {
+  auto print = [&out, &test](std::string_view word){
+    if (!test(word)) return;
+    out.Write(",");
+    out.Write(word);
+  };
+  out.Write("[");
+  if (words.size() == 1) words.ForEachWord(print);   // Nothing to sort (e.g., a loop variable).
+  else words.ForEachSortedWord(print);
+  out.Write(" ]\n");
+}
+
+template <typename WRITER>
+void PrintWordList(WRITER & out, const WordSet & words) {
+  PrintWordListIf(out, words, [](std::string_view){ return true; });
+}
+
+#endif // #ifndef WORDLANG_OUTPUT_HPP_INCLUDE_
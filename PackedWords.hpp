@@ -0,0 +1,247 @@
+#ifndef WORDLANG_PACKED_WORDS_HPP_INCLUDE_
+#define WORDLANG_PACKED_WORDS_HPP_INCLUDE_
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define WORDLANG_PACKED_AVX2 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "ThreadPool.hpp"
+#include "WordSet.hpp"
+
+// The short words of one set, packed so that a substring test checks a whole
+// block of words at a time.  Words of up to SLOT_SIZE bytes are grouped by
+// length into blocks of BLOCK_WORDS words of that length, stored struct-of-
+// arrays: row i of a block holds byte i of each of its words, so one vector
+// compare tests that byte of 16 or 32 words against a needle byte.  Each block
+// records the length of its words (the length column), so a block is only
+// searched at the starting positions its words have.  Longer words (and the
+// empty word) are listed on their own and tested one at a time.
+//
+// Like a SubstringIndex, a packed copy hangs off the body of a large set and is
+// built on its PACK_AFTER_FILTERS-th scanning filter pass (see Find()).
+namespace packed_words {
+  constexpr size_t SLOT_SIZE = 16;
+  constexpr size_t BLOCK_WORDS = 32;
+  constexpr size_t MAX_NEEDLE = SLOT_SIZE;
+
+  // Bit w is set if word w of a block of length-byte words (its rows at rows)
+  // contains needle, which is 1 to length bytes long.
+  using kernel_t = uint32_t (*)(const uint8_t * rows, size_t length, std::string_view needle);
+
+  inline uint32_t MatchScalar(const uint8_t * rows, size_t length, std::string_view needle) {
+    uint32_t found = 0;
+    for (size_t word = 0; word < BLOCK_WORDS; ++word) {
+      for (size_t pos = 0; pos + needle.size() <= length && !(found >> word & 1); ++pos) {
+        size_t i = 0;
+        while (i < needle.size() && rows[(pos + i) * BLOCK_WORDS + word] == static_cast<uint8_t>(needle[i])) ++i;
+        if (i == needle.size()) found |= uint32_t{1} << word;
+      }
+    }
+    return found;
+  }
+
+#if defined(__SSE2__)
+  inline uint32_t MatchSSE2(const uint8_t * rows, size_t length, std::string_view needle) {
+    __m128i bytes[MAX_NEEDLE];
+    for (size_t i = 0; i < needle.size(); ++i) bytes[i] = _mm_set1_epi8(needle[i]);
+    __m128i found_low = _mm_setzero_si128(), found_high = _mm_setzero_si128();
+    for (size_t pos = 0; pos + needle.size() <= length; ++pos) {
+      __m128i low = _mm_set1_epi8(-1), high = low;
+      for (size_t i = 0; i < needle.size(); ++i) {
+        const uint8_t * row = rows + (pos + i) * BLOCK_WORDS;
+        low = _mm_and_si128(low, _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(row)), bytes[i]));
+        high = _mm_and_si128(high, _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(row + 16)), bytes[i]));
+      }
+      found_low = _mm_or_si128(found_low, low);
+      found_high = _mm_or_si128(found_high, high);
+    }
+    return static_cast<uint32_t>(_mm_movemask_epi8(found_low)) |
+           static_cast<uint32_t>(_mm_movemask_epi8(found_high)) << 16;
+  }
+#endif
+
+#if defined(WORDLANG_PACKED_AVX2)
+  __attribute__((target("avx2")))
+  inline uint32_t MatchAVX2(const uint8_t * rows, size_t length, std::string_view needle) {
+    __m256i bytes[MAX_NEEDLE];
+    for (size_t i = 0; i < needle.size(); ++i) bytes[i] = _mm256_set1_epi8(needle[i]);
+    __m256i found = _mm256_setzero_si256();
+    for (size_t pos = 0; pos + needle.size() <= length; ++pos) {
+      __m256i all = _mm256_set1_epi8(-1);
+      for (size_t i = 0; i < needle.size(); ++i) {
+        const __m256i row = _mm256_load_si256(reinterpret_cast<const __m256i *>(rows + (pos + i) * BLOCK_WORDS));
+        all = _mm256_and_si256(all, _mm256_cmpeq_epi8(row, bytes[i]));
+      }
+      found = _mm256_or_si256(found, all);
+    }
+    return static_cast<uint32_t>(_mm256_movemask_epi8(found));
+  }
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+  // One bit per byte lane, as _mm_movemask_epi8 gives on x86.
+  inline uint32_t MoveMaskNEON(uint8x16_t lanes) {
+    static const uint8_t WEIGHTS[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t bits = vandq_u8(lanes, vld1q_u8(WEIGHTS));
+    return static_cast<uint32_t>(vaddv_u8(vget_low_u8(bits))) |
+           static_cast<uint32_t>(vaddv_u8(vget_high_u8(bits))) << 8;
+  }
+
+  inline uint32_t MatchNEON(const uint8_t * rows, size_t length, std::string_view needle) {
+    uint8x16_t bytes[MAX_NEEDLE];
+    for (size_t i = 0; i < needle.size(); ++i) bytes[i] = vdupq_n_u8(static_cast<uint8_t>(needle[i]));
+    uint8x16_t found_low = vdupq_n_u8(0), found_high = vdupq_n_u8(0);
+    for (size_t pos = 0; pos + needle.size() <= length; ++pos) {
+      uint8x16_t low = vdupq_n_u8(0xff), high = low;
+      for (size_t i = 0; i < needle.size(); ++i) {
+        const uint8_t * row = rows + (pos + i) * BLOCK_WORDS;
+        low = vandq_u8(low, vceqq_u8(vld1q_u8(row), bytes[i]));
+        high = vandq_u8(high, vceqq_u8(vld1q_u8(row + 16), bytes[i]));
+      }
+      found_low = vorrq_u8(found_low, low);
+      found_high = vorrq_u8(found_high, high);
+    }
+    return MoveMaskNEON(found_low) | MoveMaskNEON(found_high) << 16;
+  }
+#endif
+
+  // The best kernel this CPU can run, chosen once.
+  inline kernel_t GetKernel() {
+    static const kernel_t kernel = []() -> kernel_t {
+#if defined(WORDLANG_PACKED_AVX2)
+      if (__builtin_cpu_supports("avx2")) return MatchAVX2;
+#endif
+#if defined(__SSE2__)
+      return MatchSSE2;
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+      return MatchNEON;
+#else
+      return MatchScalar;
+#endif
+    }();
+    return kernel;
+  }
+}
+
+class PackedWords {
+public:
+  using id_t = WordSet::id_t;
+
+  static constexpr size_t PACK_AFTER_FILTERS = 2;
+  static constexpr size_t MIN_WORDS = 4096;       // Smaller sets are cheap to scan.
+
+private:
+  static constexpr size_t ROW_BYTES = packed_words::BLOCK_WORDS;
+  static constexpr size_t CHUNK_BLOCKS = 128;     // Blocks per task of a parallel Select().
+
+  struct alignas(32) Row { uint8_t bytes[ROW_BYTES]; };
+  struct Block {
+    size_t first_row;
+    uint8_t length;                               // Bytes in each of its words.
+    uint8_t count;                                // Words, from lane 0 (the rest are empty).
+  };
+
+  std::vector<Row> rows{};
+  std::vector<Block> blocks{};
+  std::vector<id_t> ids{};                        // BLOCK_WORDS per block, by lane.
+  std::vector<id_t> long_ids{};                   // Words longer than SLOT_SIZE, and "".
+
+public:
+  explicit PackedWords(const WordSet & in) {
+    const StringInterner & interner = StringInterner::Get();
+    std::array<std::vector<id_t>, packed_words::SLOT_SIZE + 1> by_length;
+    in.ForEachID([&](id_t id){
+      const size_t length = interner.GetWord(id).size();
+      if (length == 0 || length > packed_words::SLOT_SIZE) long_ids.push_back(id);
+      else by_length[length].push_back(id);
+    });
+    size_t num_blocks = 0, num_rows = 0;
+    for (size_t length = 1; length <= packed_words::SLOT_SIZE; ++length) {
+      const size_t group_blocks = (by_length[length].size() + packed_words::BLOCK_WORDS - 1) / packed_words::BLOCK_WORDS;
+      num_blocks += group_blocks;
+      num_rows += group_blocks * length;
+    }
+    blocks.reserve(num_blocks);
+    rows.resize(num_rows, Row{});
+    ids.resize(num_blocks * packed_words::BLOCK_WORDS, 0);
+    for (size_t length = 1; length <= packed_words::SLOT_SIZE; ++length) {
+      const std::vector<id_t> & group = by_length[length];
+      for (size_t start = 0; start < group.size(); start += packed_words::BLOCK_WORDS) {
+        const size_t count = std::min(packed_words::BLOCK_WORDS, group.size() - start);
+        const size_t first_row = blocks.empty() ? 0 : blocks.back().first_row + blocks.back().length;
+        Row * block_rows = &rows[first_row];
+        id_t * block_ids = &ids[blocks.size() * packed_words::BLOCK_WORDS];
+        blocks.push_back(Block{first_row, static_cast<uint8_t>(length), static_cast<uint8_t>(count)});
+        for (size_t lane = 0; lane < count; ++lane) {
+          const std::string_view word = interner.GetWord(group[start + lane]);
+          for (size_t i = 0; i < length; ++i) block_rows[i].bytes[lane] = static_cast<uint8_t>(word[i]);
+          block_ids[lane] = group[start + lane];
+        }
+      }
+    }
+  }
+
+  // The members that pass: block_test(rows, length) gives the lanes of a block
+  // that pass (bit w for word w; see packed_words::kernel_t), and test(word)
+  // decides for each long word.
+  template <typename BLOCK_FN, typename FN>
+  WordSet Select(BLOCK_FN block_test, FN test, ThreadPool & pool) const {
+    const StringInterner & interner = StringInterner::Get();
+    const size_t num_chunks = (blocks.size() + CHUNK_BLOCKS - 1) / CHUNK_BLOCKS;
+    std::vector<std::vector<id_t>> results(num_chunks + 1);
+    auto run_chunk = [&](size_t chunk){
+      std::vector<id_t> & out = results[chunk];
+      if (chunk == num_chunks) {                  // The long words.
+        for (id_t id : long_ids) if (test(interner.GetWord(id))) out.push_back(id);
+        return;
+      }
+      const size_t end = std::min(blocks.size(), (chunk + 1) * CHUNK_BLOCKS);
+      for (size_t block_id = chunk * CHUNK_BLOCKS; block_id < end; ++block_id) {
+        const Block & block = blocks[block_id];
+        uint32_t lanes = block_test(reinterpret_cast<const uint8_t *>(&rows[block.first_row]), block.length);
+        if (block.count < packed_words::BLOCK_WORDS) lanes &= (uint32_t{1} << block.count) - 1;
+        for (; lanes; lanes &= lanes - 1) {
+          out.push_back(ids[block_id * packed_words::BLOCK_WORDS + static_cast<size_t>(std::countr_zero(lanes))]);
+        }
+      }
+    };
+    pool.ParallelFor(num_chunks + 1, run_chunk);
+
+    size_t total = 0;
+    for (const auto & part : results) total += part.size();
+    std::vector<id_t> found;
+    found.reserve(total);
+    for (const auto & part : results) found.insert(found.end(), part.begin(), part.end());
+    return WordSet{std::move(found)};
+  }
+
+  // Count a scanning filter pass over words and return its packed copy, building
+  // it on the pass that reaches PACK_AFTER_FILTERS.  nullptr means "scan".
+  static std::shared_ptr<const PackedWords> Find(const WordSet & words) {
+    if (words.size() < MIN_WORDS || words.IsSpilled()) return nullptr;
+    WordSet::IndexSlot & slot = words.data->index_slot;
+    std::lock_guard<std::mutex> guard(slot.lock);
+    if (slot.packed) return slot.packed;
+    if (++slot.num_scans < PACK_AFTER_FILTERS) return nullptr;
+    slot.packed = std::make_shared<const PackedWords>(words);
+    return slot.packed;
+  }
+};
+
+#endif // #ifndef WORDLANG_PACKED_WORDS_HPP_INCLUDE_
@@ -0,0 +1,176 @@
+#ifndef WORDLANG_PROFILER_HPP_INCLUDE_
+#define WORDLANG_PROFILER_HPP_INCLUDE_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "AllocCounter.hpp"
+
+// Collects per-operation statistics for --profile and --mem-report, keyed by
+// source line and operation name.  Operations nest: Enter() starts one and
+// Exit() finishes the innermost, so "self" figures exclude nested operations,
+// and the output sizes of nested operations add up to the input size of the one
+// enclosing them.
+class Profiler {
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct Stats {
+    size_t calls = 0;
+    uint64_t total_ns = 0;
+    uint64_t self_ns = 0;
+    uint64_t in_words = 0;
+    uint64_t out_words = 0;
+    uint64_t self_bytes = 0;                 // Bytes allocated, excluding nested operations...
+    uint64_t self_allocs = 0;                // ...and how many allocations that took.
+  };
+
+  struct Frame {
+    clock::time_point start;
+    uint64_t start_bytes;
+    uint64_t start_allocs;
+    uint64_t child_ns = 0;
+    uint64_t child_bytes = 0;
+    uint64_t child_allocs = 0;
+    uint64_t child_words = 0;                // Output words of nested operations.
+  };
+
+  struct TraceEvent {
+    std::string_view name;
+    size_t line;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint64_t in_words;
+    uint64_t out_words;
+  };
+
+  std::map<std::pair<size_t, std::string_view>, Stats> stats{};
+  std::vector<Frame> stack{};
+  std::vector<TraceEvent> trace{};
+  bool keep_trace = false;
+  clock::time_point origin = clock::now();
+
+  static uint64_t Nanoseconds(clock::duration time) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+  }
+
+public:
+  // Names passed to Exit() must outlive the profiler (string literals in practice).
+  explicit Profiler(bool keep_trace=false) : keep_trace(keep_trace) {
+    alloc_counter::Enable();
+  }
+  Profiler(const Profiler &) = delete;
+  Profiler & operator=(const Profiler &) = delete;
+  ~Profiler() { alloc_counter::Enable(false); }
+
+  void Enter() {
+    stack.push_back(Frame{clock::now(), alloc_counter::GetBytes(), alloc_counter::GetAllocs()});
+  }
+
+  // Finish the innermost operation.  If in_words is not given, it is the total
+  // output of the operations nested inside this one.
+  void Exit(size_t line, std::string_view name, size_t out_words, int64_t in_words=-1) {
+    const clock::time_point end = clock::now();
+    const uint64_t end_bytes = alloc_counter::GetBytes();
+    const uint64_t end_allocs = alloc_counter::GetAllocs();
+    const Frame frame = stack.back();
+    stack.pop_back();
+
+    const uint64_t total_ns = Nanoseconds(end - frame.start);
+    const uint64_t total_bytes = end_bytes - frame.start_bytes;
+    const uint64_t total_allocs = end_allocs - frame.start_allocs;
+    const uint64_t in = in_words < 0 ? frame.child_words : static_cast<uint64_t>(in_words);
+    Stats & entry = stats[{line, name}];
+    ++entry.calls;
+    entry.total_ns += total_ns;
+    entry.self_ns += total_ns - std::min(total_ns, frame.child_ns);
+    entry.in_words += in;
+    entry.out_words += out_words;
+    entry.self_bytes += total_bytes - std::min(total_bytes, frame.child_bytes);
+    entry.self_allocs += total_allocs - std::min(total_allocs, frame.child_allocs);
+
+    if (stack.size()) {
+      stack.back().child_ns += total_ns;
+      stack.back().child_bytes += total_bytes;
+      stack.back().child_allocs += total_allocs;
+      stack.back().child_words += out_words;
+    }
+    if (keep_trace) {
+      trace.push_back(TraceEvent{name, line, Nanoseconds(frame.start - origin), total_ns,
+                                 in, out_words});
+    }
+  }
+
+  // Hot spots first: the max_rows operations with the most self time.
+  void PrintReport(std::ostream & os, size_t max_rows=25) const {
+    std::vector<std::pair<std::pair<size_t, std::string_view>, Stats>> rows(stats.begin(), stats.end());
+    std::sort(rows.begin(), rows.end(),
+              [](const auto & a, const auto & b){ return a.second.self_ns > b.second.self_ns; });
+    os << "=== Profile ===\n"
+       << std::setw(6) << "line" << "  " << std::left << std::setw(16) << "operation" << std::right
+       << std::setw(9) << "calls" << std::setw(12) << "total ms" << std::setw(12) << "self ms"
+       << std::setw(13) << "words in" << std::setw(13) << "words out"
+       << std::setw(14) << "bytes alloc" << '\n';
+    for (size_t row = 0; row < std::min(max_rows, rows.size()); ++row) {
+      const auto & [key, entry] = rows[row];
+      os << std::setw(6) << key.first << "  " << std::left << std::setw(16) << key.second << std::right
+         << std::setw(9) << entry.calls
+         << std::setw(12) << std::fixed << std::setprecision(3) << entry.total_ns / 1e6
+         << std::setw(12) << entry.self_ns / 1e6
+         << std::setw(13) << entry.in_words << std::setw(13) << entry.out_words
+         << std::setw(14) << entry.self_bytes << '\n';
+    }
+    if (rows.size() > max_rows) os << "(" << rows.size() - max_rows << " more not shown)\n";
+    os << std::flush;
+  }
+
+  // Allocations per operation name, over all lines, most bytes first.
+  void PrintAllocReport(std::ostream & os) const {
+    std::map<std::string_view, Stats> by_name;
+    for (const auto & [key, entry] : stats) {
+      Stats & total = by_name[key.second];
+      total.calls += entry.calls;
+      total.self_bytes += entry.self_bytes;
+      total.self_allocs += entry.self_allocs;
+    }
+    std::vector<std::pair<std::string_view, Stats>> rows(by_name.begin(), by_name.end());
+    std::sort(rows.begin(), rows.end(),
+              [](const auto & a, const auto & b){ return a.second.self_bytes > b.second.self_bytes; });
+    os << std::left << std::setw(16) << "operation" << std::right << std::setw(9) << "calls"
+       << std::setw(12) << "allocs" << std::setw(14) << "bytes alloc" << '\n';
+    for (const auto & [name, entry] : rows) {
+      os << std::left << std::setw(16) << name << std::right << std::setw(9) << entry.calls
+         << std::setw(12) << entry.self_allocs << std::setw(14) << entry.self_bytes << '\n';
+    }
+  }
+
+  // Write the recorded operations in Chrome trace-event format (chrome://tracing,
+  // Perfetto, or speedscope for a flame graph).
+  bool WriteTrace(const std::string & filename) const {
+    std::ofstream out(filename);
+    if (!out) return false;
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    for (size_t i = 0; i < trace.size(); ++i) {
+      const TraceEvent & event = trace[i];
+      out << (i ? ",\n" : "\n")
+          << "{\"name\":\"" << event.name << "\",\"cat\":\"line " << event.line
+          << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+          << ",\"ts\":" << event.start_ns / 1000.0 << ",\"dur\":" << event.duration_ns / 1000.0
+          << ",\"args\":{\"line\":" << event.line << ",\"words_in\":" << event.in_words
+          << ",\"words_out\":" << event.out_words << "}}";
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+  }
+};
+
+#endif // #ifndef WORDLANG_PROFILER_HPP_INCLUDE_
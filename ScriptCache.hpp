@@ -0,0 +1,233 @@
+#ifndef WORDLANG_SCRIPT_CACHE_HPP_INCLUDE_
+#define WORDLANG_SCRIPT_CACHE_HPP_INCLUDE_
+
+#include <algorithm>
+#include <assert.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VirtualMachine.hpp"
+#include "WordLoader.hpp"
+#include "WordSet.hpp"
+
+// Compiled scripts cached on disk ("--cache-dir DIR"), so an unchanged script
+// skips lexing, parsing, optimizing and compiling.  A cache file is named for a
+// hash of the script text and the settings that change what it compiles to:
+//
+//   "WLCACHE2\n" | build | settings | source size | source hash | contents hash | contents...
+//
+// The contents are written by the interpreter (its ByteCode, see WriteByteCode(),
+// plus whatever else it needs to run without the tree).  Fixed-size values and
+// arrays of them are stored in the interpreter's own memory layout, so a file
+// is only read back by the same build: any other build, settings or source
+// makes a file a miss, and it is written again.  The byte code is run as read,
+// so contents that do not match their hash (a damaged file) are a miss too.
+namespace script_cache {
+  constexpr std::string_view MAGIC = "WLCACHE2\n";
+  constexpr std::string_view BUILD = __DATE__ " " __TIME__;   // Changes on every rebuild.
+
+  // FNV-1a, which is the same from run to run (unlike std::hash).
+  inline uint64_t Hash(std::string_view text) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : text) hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+    return hash;
+  }
+
+  class Writer {
+  private:
+    std::string out{};
+
+  public:
+    const std::string & GetText() const { return out; }
+
+    template <typename T>
+    void Put(const T & value) {
+      static_assert(std::is_trivially_copyable_v<T>);
+      out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void PutArray(const std::vector<T> & values) {
+      static_assert(std::is_trivially_copyable_v<T>);
+      Put<uint64_t>(values.size());
+      out.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+    void PutString(std::string_view text) {
+      Put<uint64_t>(text.size());
+      out.append(text);
+    }
+  };
+
+  // Reads what a Writer wrote.  Running off the end of the data clears IsOK()
+  // and returns zeros, so a truncated file is just a miss.
+  class Reader {
+  private:
+    std::string_view data;
+    size_t pos = 0;
+    bool ok = true;
+
+    const char * Take(size_t size) {
+      if (!ok || size > data.size() - pos) { ok = false; return nullptr; }
+      pos += size;
+      return data.data() + pos - size;
+    }
+
+  public:
+    explicit Reader(std::string_view data) : data(data) { }
+
+    bool IsOK() const { return ok; }
+    bool AtEnd() const { return pos == data.size(); }
+    std::string_view GetRest() const { return data.substr(pos); }
+
+    template <typename T>
+    T Get() {
+      T value{};
+      if (const char * at = Take(sizeof(T))) std::memcpy(&value, at, sizeof(T));
+      return value;
+    }
+
+    template <typename T>
+    std::vector<T> GetArray() {
+      const uint64_t count = Get<uint64_t>();
+      std::vector<T> values;
+      if (count > (data.size() - pos) / sizeof(T)) { ok = false; return values; }
+      if (!count) return values;
+      values.resize(count);
+      if (const char * at = Take(count * sizeof(T))) std::memcpy(values.data(), at, count * sizeof(T));
+      return values;
+    }
+
+    std::string_view GetString() {
+      const uint64_t size = Get<uint64_t>();
+      if (size > data.size() - pos) { ok = false; return {}; }
+      return std::string_view(Take(size), size);
+    }
+  };
+
+  // Where the cache file for a script goes.
+  inline std::string FileName(const std::string & dir, std::string_view source, uint64_t settings) {
+    char name[48];
+    std::snprintf(name, sizeof(name), "/%016llx-%llx.wlc",
+                  static_cast<unsigned long long>(Hash(source)), static_cast<unsigned long long>(settings));
+    return dir + name;
+  }
+
+  // The file for a script: everything that must match for it to be used, then
+  // the contents.
+  inline std::string MakeFile(std::string_view source, uint64_t settings, const Writer & contents) {
+    Writer out;
+    out.PutString(MAGIC);
+    out.PutString(BUILD);
+    out.Put<uint64_t>(settings);
+    out.Put<uint64_t>(source.size());
+    out.Put<uint64_t>(Hash(source));
+    out.Put<uint64_t>(Hash(contents.GetText()));
+    return out.GetText() + contents.GetText();
+  }
+
+  // Is the file read by in for this script, build and settings, with its
+  // contents intact?  If so, in is left at the start of the contents.
+  inline bool CheckHeader(Reader & in, std::string_view source, uint64_t settings) {
+    if (!(in.GetString() == MAGIC && in.GetString() == BUILD && in.Get<uint64_t>() == settings &&
+          in.Get<uint64_t>() == source.size() && in.Get<uint64_t>() == Hash(source))) return false;
+    const uint64_t contents_hash = in.Get<uint64_t>();
+    return in.IsOK() && Hash(in.GetRest()) == contents_hash;
+  }
+
+  // Make the cache directory, and any missing parents; false if it cannot be.
+  inline bool MakeDir(const std::string & dir) {
+    for (size_t end = dir.find('/', 1); ; end = dir.find('/', end + 1)) {
+      const std::string part = dir.substr(0, end);
+      if (part.size() && mkdir(part.c_str(), 0777) != 0 && errno != EEXIST) return false;
+      if (end == std::string::npos) break;
+    }
+    struct stat info;
+    return stat(dir.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+  }
+
+  // Write a cache file in one go: to a temporary file in the same directory,
+  // renamed into place, so a reader never sees half of one.  Returns false if
+  // it could not be written.
+  inline bool WriteFile(const std::string & filename, std::string_view text) {
+    std::string temp_name = filename + ".XXXXXX";
+    const int fd = mkstemp(temp_name.data());
+    if (fd < 0) return false;
+    bool ok = true;
+    while (ok && text.size()) {
+      const ssize_t count = write(fd, text.data(), text.size());
+      if (count < 0 && errno == EINTR) continue;
+      ok = count > 0;
+      if (ok) text.remove_prefix(static_cast<size_t>(count));
+    }
+    close(fd);
+    if (!ok || std::rename(temp_name.c_str(), filename.c_str()) != 0) {
+      unlink(temp_name.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  template <typename T>
+  void PutNested(Writer & out, const std::vector<std::vector<T>> & lists) {
+    out.Put<uint64_t>(lists.size());
+    for (const std::vector<T> & list : lists) out.PutArray(list);
+  }
+
+  template <typename T>
+  std::vector<std::vector<T>> GetNested(Reader & in) {
+    std::vector<std::vector<T>> lists(std::min<uint64_t>(in.Get<uint64_t>(), 1 << 24));
+    for (std::vector<T> & list : lists) list = in.GetArray<T>();
+    return lists;
+  }
+
+  // Constants are stored as their sorted words and interned again when read.
+  // Only server requests have needle words, and they are never cached.
+  inline void WriteByteCode(Writer & out, const ByteCode & program) {
+    assert(program.needle_words.empty());
+    out.PutArray(program.code);
+    out.PutArray(program.lines);
+    out.Put<uint64_t>(program.constants.size());
+    for (const WordSet & constant : program.constants) {
+      out.Put<uint64_t>(constant.size());
+      constant.ForEachSortedWord([&out](std::string_view word){ out.PutString(word); });
+    }
+    out.PutArray(program.stages);
+    out.PutArray(program.operands);
+    PutNested(out, program.cache_slots);
+    out.PutArray(program.statements);
+    PutNested(out, program.statement_deps);
+    out.Put<uint64_t>(program.num_vars);
+    out.Put<uint64_t>(program.num_registers);
+  }
+
+  inline bool ReadByteCode(Reader & in, ByteCode & program) {
+    program.code = in.GetArray<ByteCode::Instruction>();
+    program.lines = in.GetArray<size_t>();
+    program.constants.resize(std::min<uint64_t>(in.Get<uint64_t>(), 1 << 24));
+    for (WordSet & constant : program.constants) {
+      WordSetBuilder builder;
+      for (uint64_t count = in.Get<uint64_t>(); count && in.IsOK(); --count) builder.Add(in.GetString());
+      constant = builder.Build();
+    }
+    program.stages = in.GetArray<ByteCode::FilterStage>();
+    program.operands = in.GetArray<ByteCode::reg_t>();
+    program.cache_slots = GetNested<size_t>(in);
+    program.statements = in.GetArray<ByteCode::Statement>();
+    program.statement_deps = GetNested<size_t>(in);
+    program.num_vars = in.Get<uint64_t>();
+    program.num_registers = in.Get<uint64_t>();
+    return in.IsOK();
+  }
+}
+
+#endif // #ifndef WORDLANG_SCRIPT_CACHE_HPP_INCLUDE_
@@ -0,0 +1,23 @@
+#ifndef WORDLANG_SCRIPT_ERROR_HPP_INCLUDE_
+#define WORDLANG_SCRIPT_ERROR_HPP_INCLUDE_
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+// An error in a script, with the source line it came from.  The command-line
+// tool reports it and exits; the server reports it for one request and goes on.
+class ScriptError : public std::runtime_error {
+private:
+  size_t line;
+
+public:
+  ScriptError(size_t line, const std::string & message) : std::runtime_error(message), line(line) { }
+
+  size_t GetLine() const { return line; }
+
+  // The error as it is shown to users: "ERROR (line N): message"
+  std::string Describe() const { return "ERROR (line " + std::to_string(line) + "): " + what(); }
+};
+
+#endif // #ifndef WORDLANG_SCRIPT_ERROR_HPP_INCLUDE_
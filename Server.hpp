@@ -0,0 +1,128 @@
+#ifndef WORDLANG_SERVER_HPP_INCLUDE_
+#define WORDLANG_SERVER_HPP_INCLUDE_
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Line protocol for server mode.  A request is a script fragment: the lines up
+// to one holding only "." (or the end of the input).  The reply is whatever the
+// fragment printed, then one status line with the time the request took:
+//
+//   OK 0.412ms
+//   ERROR 0.107ms (line 2): Unknown variable 'x'.
+//
+// Printed lists always start with '[', so the status line is easy to find.
+namespace server {
+  // Run one request: print into output and return an error message ("" if it
+  // succeeded).
+  using handler_t = std::function<std::string(std::string_view source, std::string & output)>;
+
+  inline bool WriteAll(int fd, std::string_view text) {
+    while (text.size()) {
+      const ssize_t count = write(fd, text.data(), text.size());
+      if (count < 0) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      text.remove_prefix(static_cast<size_t>(count));
+    }
+    return true;
+  }
+
+  // Run a request and build its reply.
+  inline std::string Reply(std::string_view source, const handler_t & handler) {
+    const auto start = std::chrono::steady_clock::now();
+    std::string reply;
+    const std::string error = handler(source, reply);
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    char time[32];
+    std::snprintf(time, sizeof(time), "%.3fms", elapsed.count());
+    reply += error.empty() ? "OK " : "ERROR ";
+    reply += time;
+    if (error.size()) reply += " " + error;
+    reply += "\n";
+    return reply;
+  }
+}
+
+// Answer requests read from in_fd on out_fd, one at a time, until the input
+// ends or a reply cannot be written.
+inline void ServeStream(int in_fd, int out_fd, const server::handler_t & handler) {
+  std::string pending;                  // Input not yet split into lines.
+  std::string source;                   // The request being collected.
+  bool has_request = false;
+  bool at_end = false;
+  char buffer[1 << 16];
+  while (!at_end) {
+    const ssize_t count = read(in_fd, buffer, sizeof(buffer));
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) {
+      at_end = true;
+      if (pending.size()) pending += '\n';  // The last line need not end in a newline.
+    }
+    else pending.append(buffer, static_cast<size_t>(count));
+
+    size_t line_start = 0;
+    for (size_t newline; (newline = pending.find('\n', line_start)) != std::string::npos; ) {
+      std::string_view line(pending.data() + line_start, newline - line_start);
+      if (line.size() && line.back() == '\r') line.remove_suffix(1);
+      line_start = newline + 1;
+      if (line != ".") {
+        source.append(line);
+        source += '\n';
+        has_request = true;
+        continue;
+      }
+      if (!server::WriteAll(out_fd, server::Reply(source, handler))) return;
+      source.clear();
+      has_request = false;
+    }
+    pending.erase(0, line_start);
+  }
+  if (has_request) server::WriteAll(out_fd, server::Reply(source, handler));
+}
+
+// Listen on a Unix socket at path and serve each connection on a thread of its
+// own, so requests from different clients run at the same time.  Only returns
+// (false) if the socket cannot be set up.
+inline bool ServeSocket(const std::string & path, const server::handler_t & handler) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) return false;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) return false;
+  unlink(path.c_str());
+  if (bind(listen_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    close(listen_fd);
+    return false;
+  }
+  std::signal(SIGPIPE, SIG_IGN);        // A client leaving early only ends its connection.
+  while (true) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      close(listen_fd);
+      return false;
+    }
+    std::thread([fd, &handler]{
+      ServeStream(fd, fd, handler);
+      close(fd);
+    }).detach();
+  }
+}
+
+#endif // #ifndef WORDLANG_SERVER_HPP_INCLUDE_
@@ -0,0 +1,99 @@
+#ifndef WORDLANG_SNAPSHOT_HPP_INCLUDE_
+#define WORDLANG_SNAPSHOT_HPP_INCLUDE_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SnapshotFormat.hpp"
+#include "ThreadPool.hpp"
+#include "WordSet.hpp"
+
+// Loading and saving word set snapshots (the format is in SnapshotFormat.hpp).
+
+// Intern every word of a snapshot.  Blocks decode independently, so groups of
+// them are decoded in parallel; the words are already unique, so no
+// de-duplication is needed.  Throws snapshot::DamagedError if the blocks do not
+// decode.
+inline WordSet LoadSnapshot(std::string_view text, ThreadPool & pool) {
+  constexpr size_t GROUP_BLOCKS = 256;
+  const snapshot::Layout layout = GetSnapshotLayout(text);
+  const size_t num_groups = (layout.num_blocks + GROUP_BLOCKS - 1) / GROUP_BLOCKS;
+  std::vector<std::vector<WordSet::id_t>> groups(num_groups);
+  StringInterner & interner = StringInterner::Get();
+  pool.ParallelFor(num_groups, [&](size_t group){
+    std::vector<WordSet::id_t> & ids = groups[group];
+    ids.reserve(GROUP_BLOCKS * snapshot::BLOCK_WORDS);
+    snapshot::Cursor cursor(layout, group * GROUP_BLOCKS, (group + 1) * GROUP_BLOCKS);
+    while (cursor.Next()) ids.push_back(interner.Intern(cursor.Word()));
+    if (cursor.IsDamaged()) throw snapshot::DamagedError();
+  });
+  size_t total = 0;
+  for (const auto & ids : groups) total += ids.size();
+  std::vector<WordSet::id_t> ids;
+  ids.reserve(total);
+  for (const auto & group : groups) ids.insert(ids.end(), group.begin(), group.end());
+  return WordSet{std::move(ids)};
+}
+
+// Write words to filename as a snapshot.  The file is written under a temporary
+// name and then renamed, so anyone still reading the old file (including a
+// mapping made by load()) keeps seeing complete contents.  Returns false on
+// failure.
+inline bool WriteSnapshot(const std::string & filename, const WordSet & words) {
+  std::string index;
+  std::string blocks;
+  uint64_t header[2] = {words.size(), 0};
+  std::string_view index_text, blocks_text;
+  if (const SpillRun * run = words.GetSpillRun()) {   // Already encoded on disk.
+    header[1] = run->GetLayout().num_blocks;
+    index_text = run->GetIndex();
+    blocks_text = run->GetLayout().blocks;
+  } else {
+    snapshot::Encoder encoder;
+    for (std::string_view word : words.SortedWords()) {
+      if (encoder.StartsBlock()) {
+        const uint64_t offset = blocks.size();
+        index.append(reinterpret_cast<const char *>(&offset), sizeof(offset));
+        ++header[1];
+      }
+      encoder.Add(word, blocks);
+    }
+    index_text = index;
+    blocks_text = blocks;
+  }
+
+  const std::string temp_name = filename + ".tmp";
+  {
+    std::ofstream out(temp_name, std::ios::binary);
+    if (!out) return false;
+    out.write(snapshot::MAGIC.data(), static_cast<std::streamsize>(snapshot::MAGIC.size()));
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    out.write(index_text.data(), static_cast<std::streamsize>(index_text.size()));
+    out.write(blocks_text.data(), static_cast<std::streamsize>(blocks_text.size()));
+    if (!out.flush()) { std::remove(temp_name.c_str()); return false; }
+  }
+  if (std::rename(temp_name.c_str(), filename.c_str()) != 0) {
+    std::remove(temp_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Run save(words, filenames): filenames must name exactly one file.  Returns an
+// error message, or an empty string on success.
+inline std::string SaveSnapshot(const WordSet & words, const WordSet & filenames) {
+  if (filenames.size() != 1) {
+    return "save() needs exactly one filename, but found " + std::to_string(filenames.size()) + ".";
+  }
+  const std::string filename(filenames.SortedWords()[0]);
+  if (!WriteSnapshot(filename, words)) return "Unable to write snapshot '" + filename + "'.";
+  return "";
+}
+
+#endif // #ifndef WORDLANG_SNAPSHOT_HPP_INCLUDE_
@@ -0,0 +1,205 @@
+#ifndef WORDLANG_SNAPSHOT_FORMAT_HPP_INCLUDE_
+#define WORDLANG_SNAPSHOT_FORMAT_HPP_INCLUDE_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Word set snapshots, as written by save() and read back by load().  The words
+// are stored sorted and front-coded: each word is the length of the prefix it
+// shares with the previous word, then the rest of its text.  Every BLOCK_WORDS
+// words a block restarts with a full word, and an index of block offsets lets a
+// reader start at any block.  Lengths are LEB128 varints; header fields are
+// native-endian 64-bit integers.
+//
+//   "WLSNAP1\n" | num_words | num_blocks | block offsets... | blocks...
+//
+// Spilled sets (see Spill.hpp) keep their words in the same blocks.
+namespace snapshot {
+  constexpr std::string_view MAGIC = "WLSNAP1\n";
+  constexpr size_t BLOCK_WORDS = 16;
+  constexpr size_t HEADER_SIZE = MAGIC.size() + 2 * sizeof(uint64_t);
+
+  inline void PutVarint(std::string & out, uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+  }
+
+  // Read a varint at pos, advancing it; false if the data ends first.
+  inline bool GetVarint(std::string_view data, size_t & pos, uint64_t & value) {
+    value = 0;
+    for (unsigned shift = 0; pos < data.size() && shift < 64; shift += 7) {
+      const auto byte = static_cast<unsigned char>(data[pos++]);
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return false;
+  }
+
+  inline uint64_t GetHeaderField(std::string_view text, size_t field) {
+    uint64_t value;
+    std::memcpy(&value, text.data() + MAGIC.size() + field * sizeof(uint64_t), sizeof(value));
+    return value;
+  }
+
+  // Thrown when the blocks of a snapshot do not decode (see Cursor).
+  struct DamagedError : std::runtime_error {
+    DamagedError() : std::runtime_error("Damaged snapshot.") { }
+  };
+
+  // Where the words of a snapshot are: its block index and its blocks.
+  struct Layout {
+    uint64_t num_words = 0;
+    size_t num_blocks = 0;
+    const char * index = nullptr;         // num_blocks offsets into blocks.
+    std::string_view blocks{};
+
+    uint64_t BlockOffset(size_t block) const {
+      uint64_t offset;
+      std::memcpy(&offset, index + block * sizeof(uint64_t), sizeof(offset));
+      return offset;
+    }
+  };
+
+  // Front-codes words, given in increasing order without repeats, onto the end
+  // of a block buffer.
+  class Encoder {
+  private:
+    std::string prev{};
+    uint64_t num_words = 0;
+
+  public:
+    uint64_t GetNumWords() const { return num_words; }
+
+    // Does the next word start a block?  (If so, its offset goes in the index.)
+    bool StartsBlock() const { return num_words % BLOCK_WORDS == 0; }
+
+    void Add(std::string_view word, std::string & blocks) {
+      size_t shared = 0;
+      if (!StartsBlock()) {
+        const size_t limit = std::min(prev.size(), word.size());
+        while (shared < limit && prev[shared] == word[shared]) ++shared;
+        PutVarint(blocks, shared);
+      }
+      PutVarint(blocks, word.size() - shared);
+      blocks.append(word.substr(shared));
+      prev.assign(word);
+      ++num_words;
+    }
+  };
+
+  // Reads the words of blocks [first_block, end_block) in sorted order.  Words
+  // are rebuilt one at a time in a buffer, so each view is only valid until the
+  // next call to Next().  Decoding stops at the first sign of a truncated or
+  // corrupt file (a varint that runs off the end, a word out of order, a block
+  // that does not end where the next one starts), and IsDamaged() is then set.
+  class Cursor {
+  private:
+    Layout layout;
+    size_t block;                         // Next block to start.
+    size_t end_block;
+    uint64_t block_words = 0;             // Words in the current block...
+    uint64_t block_read = 0;              // ...and how many have been read.
+    size_t pos = 0;
+    std::string word{};
+    bool has_word = false;                // Does word hold the last word read?
+    bool damaged = false;
+
+    bool Stop() {
+      block = end_block;
+      block_words = block_read = 0;
+      return false;
+    }
+    bool Fail() { damaged = true; return Stop(); }
+
+  public:
+    Cursor(const Layout & layout, size_t first_block=0, size_t end_block=static_cast<size_t>(-1))
+      : layout(layout), block(first_block), end_block(std::min(end_block, layout.num_blocks)) { }
+
+    // Move to the next word; false once there are none left.
+    bool Next() {
+      while (block_read == block_words) {
+        if (block_words) {                  // A block ends where the next one starts.
+          const uint64_t end = block < layout.num_blocks ? layout.BlockOffset(block) : layout.blocks.size();
+          if (pos != end) return Fail();
+        }
+        if (block >= end_block || block * BLOCK_WORDS >= layout.num_words) return Stop();
+        block_words = std::min<uint64_t>(BLOCK_WORDS, layout.num_words - block * BLOCK_WORDS);
+        block_read = 0;
+        pos = layout.BlockOffset(block++);
+      }
+      const std::string_view blocks = layout.blocks;
+      uint64_t shared = 0, suffix = 0;
+      if (block_read && !GetVarint(blocks, pos, shared)) return Fail();
+      if (!GetVarint(blocks, pos, suffix)) return Fail();
+      if (shared > word.size() || suffix > blocks.size() || pos > blocks.size() - suffix) return Fail();
+      // Each word must follow the one before: inside a block it differs from it
+      // first at the byte after the shared prefix.
+      const std::string_view rest(blocks.data() + pos, suffix);
+      if (block_read) {
+        if (!suffix || (shared < word.size() && static_cast<unsigned char>(rest[0]) <=
+                                                static_cast<unsigned char>(word[shared]))) return Fail();
+      }
+      else if (has_word && rest <= std::string_view(word)) return Fail();
+      has_word = true;
+      word.resize(shared);
+      word.append(blocks.data() + pos, suffix);
+      pos += suffix;
+      ++block_read;
+      return true;
+    }
+
+    std::string_view Word() const { return word; }
+    bool IsDamaged() const { return damaged; }
+  };
+}
+
+// Is this file text a snapshot?  It must start with the magic line, and its
+// header must agree with the file: one block per BLOCK_WORDS words, an index
+// that fits, and block offsets that start at 0 and increase inside the blocks.
+// Any other file is a word list (whose first word may be "WLSNAP1").
+inline bool IsSnapshot(std::string_view text) {
+  if (text.size() < snapshot::HEADER_SIZE || !text.starts_with(snapshot::MAGIC)) return false;
+  const uint64_t num_words = snapshot::GetHeaderField(text, 0);
+  const uint64_t num_blocks = snapshot::GetHeaderField(text, 1);
+  if (num_blocks != num_words / snapshot::BLOCK_WORDS + (num_words % snapshot::BLOCK_WORDS != 0) ||
+      num_blocks > (text.size() - snapshot::HEADER_SIZE) / sizeof(uint64_t)) return false;
+  snapshot::Layout layout;
+  layout.num_blocks = static_cast<size_t>(num_blocks);
+  layout.index = text.data() + snapshot::HEADER_SIZE;
+  const uint64_t blocks_size = text.size() - snapshot::HEADER_SIZE - num_blocks * sizeof(uint64_t);
+  for (size_t block = 0; block < layout.num_blocks; ++block) {
+    const uint64_t offset = layout.BlockOffset(block);
+    if (offset >= blocks_size || (block ? offset <= layout.BlockOffset(block - 1) : offset != 0)) return false;
+  }
+  return true;
+}
+
+// The layout of a snapshot file's text (no words if it is not a snapshot).
+inline snapshot::Layout GetSnapshotLayout(std::string_view text) {
+  snapshot::Layout layout;
+  if (!IsSnapshot(text)) return layout;
+  layout.num_words = snapshot::GetHeaderField(text, 0);
+  layout.num_blocks = static_cast<size_t>(snapshot::GetHeaderField(text, 1));
+  layout.index = text.data() + snapshot::HEADER_SIZE;
+  layout.blocks = text.substr(snapshot::HEADER_SIZE + layout.num_blocks * sizeof(uint64_t));
+  return layout;
+}
+
+// Call fn(word) for every word of a snapshot, in sorted order.  Each view is
+// only valid during its call.  Throws snapshot::DamagedError if the blocks do
+// not decode.
+template <typename FN>
+void ForEachSnapshotWord(std::string_view text, FN fn) {
+  snapshot::Cursor cursor(GetSnapshotLayout(text));
+  while (cursor.Next()) fn(cursor.Word());
+  if (cursor.IsDamaged()) throw snapshot::DamagedError();
+}
+
+#endif // #ifndef WORDLANG_SNAPSHOT_FORMAT_HPP_INCLUDE_
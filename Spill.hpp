@@ -0,0 +1,210 @@
+#ifndef WORDLANG_SPILL_HPP_INCLUDE_
+#define WORDLANG_SPILL_HPP_INCLUDE_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "SnapshotFormat.hpp"
+
+// Spilling: with a memory budget set ("--spill-budget MB"), a set whose words
+// would take more than the budget to hold in memory is written to disk instead,
+// as one sorted run of words.  A run is the blocks of a snapshot followed by
+// their index (see SnapshotFormat.hpp), in a temporary file that is unlinked as
+// soon as it is made and then mapped, so it goes away with the last set using
+// it, even if the program is killed.
+//
+// Runs are only ever read in order: union, difference, filters, print and save
+// stream through them (see WordSet), and a file bigger than the budget is
+// loaded by sorting batches of its words into runs and merging them (see
+// WordLoader.hpp).  Mapped pages are backed by the file, so the kernel can
+// always drop them to make room.
+namespace spill {
+  struct Settings {
+    size_t budget = 0;                    // Bytes; 0 means never spill.
+    std::string dir{};                    // Where runs go ($TMPDIR or /tmp).
+  };
+
+  inline Settings & GetSettings() {
+    static Settings settings{0, std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp"};
+    return settings;
+  }
+
+  // Bytes a word is counted as taking while it is held in memory.
+  inline size_t WordCost(std::string_view word) { return word.size() + 16; }
+
+  // Is a file of this size too big to load into memory?
+  inline bool IsOverBudget(size_t bytes) {
+    return GetSettings().budget && bytes > GetSettings().budget;
+  }
+
+  [[noreturn]] inline void Fail() {
+    throw std::runtime_error("Unable to write spill file in '" + GetSettings().dir + "'.");
+  }
+
+  // A temporary file that is already unlinked.
+  inline int MakeTempFile() {
+    std::string name = GetSettings().dir + "/wordlang-spill-XXXXXX";
+    const int fd = mkstemp(name.data());
+    if (fd < 0) Fail();
+    unlink(name.c_str());
+    return fd;
+  }
+
+  inline void WriteAll(int fd, std::string_view data) {
+    while (data.size()) {
+      const ssize_t count = write(fd, data.data(), data.size());
+      if (count < 0) {
+        if (errno == EINTR) continue;
+        Fail();
+      }
+      data.remove_prefix(static_cast<size_t>(count));
+    }
+  }
+}
+
+// Words, sorted and unique, in a run on disk.
+class SpillRun {
+private:
+  void * map_base = nullptr;
+  size_t map_size = 0;
+  snapshot::Layout layout{};
+
+public:
+  // Map a run file: blocks_size bytes of blocks, then the index.
+  SpillRun(int fd, uint64_t num_words, size_t num_blocks, size_t blocks_size)
+    : map_size(blocks_size + num_blocks * sizeof(uint64_t)) {
+    map_base = map_size ? mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (map_base == MAP_FAILED) { map_base = nullptr; spill::Fail(); }
+    const char * text = static_cast<const char *>(map_base);
+    layout.num_words = num_words;
+    layout.num_blocks = num_blocks;
+    layout.blocks = std::string_view(text, blocks_size);
+    layout.index = text + blocks_size;
+  }
+  SpillRun(const SpillRun &) = delete;
+  SpillRun & operator=(const SpillRun &) = delete;
+  ~SpillRun() { if (map_base) munmap(map_base, map_size); }
+
+  size_t GetNumWords() const { return static_cast<size_t>(layout.num_words); }
+  const snapshot::Layout & GetLayout() const { return layout; }
+  snapshot::Cursor GetCursor() const { return snapshot::Cursor(layout); }
+
+  // The index, as stored in a snapshot file.
+  std::string_view GetIndex() const {
+    return std::string_view(layout.index, layout.num_blocks * sizeof(uint64_t));
+  }
+
+  // Binary search on the first word of each block, then a scan of one block.
+  bool Contains(std::string_view word) const {
+    size_t low = 0, high = layout.num_blocks;       // Answer is in blocks [low, high).
+    while (high - low > 1) {
+      const size_t mid = low + (high - low) / 2;
+      snapshot::Cursor cursor(layout, mid, mid + 1);
+      if (cursor.Next() && cursor.Word() <= word) low = mid;
+      else high = mid;
+    }
+    snapshot::Cursor cursor(layout, low, low + 1);
+    while (cursor.Next()) {
+      if (cursor.Word() >= word) return cursor.Word() == word;
+    }
+    return false;
+  }
+};
+
+// Writes words, given in increasing order without repeats, to a new run.  The
+// blocks stream to the run file and the index to a file of its own, which is
+// appended to the run at the end.
+class SpillWriter {
+private:
+  static constexpr size_t FLUSH_SIZE = 1 << 20;
+
+  int fd;
+  int index_fd;
+  std::string blocks{};                   // Not yet written...
+  std::string index{};
+  size_t blocks_written = 0;              // ...and already written.
+  size_t num_blocks = 0;
+  snapshot::Encoder encoder{};
+
+public:
+  SpillWriter() : fd(spill::MakeTempFile()), index_fd(spill::MakeTempFile()) { }
+  SpillWriter(const SpillWriter &) = delete;
+  SpillWriter & operator=(const SpillWriter &) = delete;
+  ~SpillWriter() {
+    if (fd >= 0) close(fd);
+    close(index_fd);
+  }
+
+  void Add(std::string_view word) {
+    if (encoder.StartsBlock()) {
+      const uint64_t offset = blocks_written + blocks.size();
+      index.append(reinterpret_cast<const char *>(&offset), sizeof(offset));
+      ++num_blocks;
+      if (index.size() >= FLUSH_SIZE) { spill::WriteAll(index_fd, index); index.clear(); }
+    }
+    encoder.Add(word, blocks);
+    if (blocks.size() >= FLUSH_SIZE) {
+      spill::WriteAll(fd, blocks);
+      blocks_written += blocks.size();
+      blocks.clear();
+    }
+  }
+
+  std::shared_ptr<const SpillRun> Finish() {
+    spill::WriteAll(fd, blocks);
+    blocks_written += blocks.size();
+    blocks = std::string{};
+    spill::WriteAll(index_fd, index);
+    index = std::string{};
+    if (lseek(index_fd, 0, SEEK_SET) != 0) spill::Fail();
+    char buffer[1 << 16];
+    ssize_t count;
+    while ((count = read(index_fd, buffer, sizeof(buffer))) > 0) {
+      spill::WriteAll(fd, std::string_view(buffer, static_cast<size_t>(count)));
+    }
+    if (count < 0) spill::Fail();
+    const int run_fd = fd;
+    fd = -1;                              // The run owns it now.
+    return std::make_shared<const SpillRun>(run_fd, encoder.GetNumWords(), num_blocks, blocks_written);
+  }
+};
+
+// Call fn(word) for each distinct word of several runs, in sorted order (a
+// k-way merge).  Each view is only valid during its call.
+template <typename FN>
+void MergeSpillRuns(const std::vector<std::shared_ptr<const SpillRun>> & runs, FN fn) {
+  std::vector<snapshot::Cursor> cursors;
+  std::vector<size_t> heap;               // Cursors that have a word, smallest on top.
+  for (const auto & run : runs) {
+    cursors.push_back(run->GetCursor());
+    if (cursors.back().Next()) heap.push_back(cursors.size() - 1);
+  }
+  auto later = [&cursors](size_t a, size_t b){ return cursors[a].Word() > cursors[b].Word(); };
+  std::make_heap(heap.begin(), heap.end(), later);
+  std::string prev;
+  bool first = true;
+  while (heap.size()) {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    snapshot::Cursor & cursor = cursors[heap.back()];
+    if (first || cursor.Word() != prev) {
+      fn(cursor.Word());
+      prev.assign(cursor.Word());
+      first = false;
+    }
+    if (cursor.Next()) std::push_heap(heap.begin(), heap.end(), later);
+    else heap.pop_back();
+  }
+}
+
+#endif // #ifndef WORDLANG_SPILL_HPP_INCLUDE_
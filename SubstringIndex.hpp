@@ -0,0 +1,130 @@
+#ifndef WORDLANG_SUBSTRING_INDEX_HPP_INCLUDE_
+#define WORDLANG_SUBSTRING_INDEX_HPP_INCLUDE_
+
+#include <algorithm>
+#include <assert.h>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "WordSet.hpp"
+
+// Inverted index of the 3-byte substrings (trigrams) of one set's words.  A
+// word can only contain a needle of three or more bytes if it contains every
+// trigram of that needle, so the candidates for a needle are the words listed
+// under its rarest trigram, and only those are checked.  A lookup then costs
+// time in proportion to the matches (plus some false candidates) rather than a
+// scan of the whole set.  Trigrams are hashed into a fixed number of buckets;
+// a collision only adds candidates, which are checked anyway.
+//
+// Sets build an index lazily: the body of a large set gets one on its
+// INDEX_AFTER_FILTERS-th filter pass (see Find()).  The index hangs off that
+// body, so it is shared by every variable or temporary holding the same value
+// and goes away with it; assigning a new value to a variable simply stops using
+// the old body, and updating a body in place drops its index.
+class SubstringIndex {
+public:
+  using id_t = WordSet::id_t;
+
+  static constexpr size_t GRAM_SIZE = 3;          // Shorter needles are scanned for.
+  static constexpr size_t INDEX_AFTER_FILTERS = 3;
+  static constexpr size_t MIN_WORDS = 4096;       // Smaller sets are cheap to scan.
+
+private:
+  static constexpr size_t BUCKET_BITS = 18;
+  static constexpr size_t NUM_BUCKETS = size_t{1} << BUCKET_BITS;
+
+  std::vector<std::string_view> words{};          // Members in ID order.
+  std::vector<id_t> ids{};
+  std::vector<uint32_t> bucket_start{};           // Postings of bucket b: [start[b], start[b+1]).
+  std::vector<uint32_t> postings{};               // Word indices, increasing within a bucket.
+
+  static size_t Bucket(const char * gram) {
+    const uint32_t value = static_cast<uint32_t>(static_cast<unsigned char>(gram[0])) << 16 |
+                           static_cast<uint32_t>(static_cast<unsigned char>(gram[1])) << 8 |
+                           static_cast<uint32_t>(static_cast<unsigned char>(gram[2]));
+    return (value * 0x9E3779B1u) >> (32 - BUCKET_BITS);
+  }
+
+  // Call fn(bucket) once for each distinct bucket among word's trigrams.
+  template <typename FN>
+  static void ForEachBucket(std::string_view word, std::vector<uint32_t> & scratch, FN fn) {
+    if (word.size() < GRAM_SIZE) return;
+    scratch.clear();
+    for (size_t pos = 0; pos + GRAM_SIZE <= word.size(); ++pos) {
+      scratch.push_back(static_cast<uint32_t>(Bucket(word.data() + pos)));
+    }
+    std::sort(scratch.begin(), scratch.end());
+    scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+    for (uint32_t bucket : scratch) fn(bucket);
+  }
+
+public:
+  explicit SubstringIndex(const WordSet & in) {
+    words.reserve(in.size());
+    ids.reserve(in.size());
+    const StringInterner & interner = StringInterner::Get();
+    in.ForEachID([this, &interner](id_t id){
+      ids.push_back(id);
+      words.push_back(interner.GetWord(id));
+    });
+
+    // Count the postings of each bucket, then fill them in word order.
+    std::vector<uint32_t> scratch;
+    std::vector<size_t> counts(NUM_BUCKETS + 1, 0);
+    for (std::string_view word : words) {
+      ForEachBucket(word, scratch, [&counts](uint32_t bucket){ ++counts[bucket + 1]; });
+    }
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket) counts[bucket + 1] += counts[bucket];
+    if (counts[NUM_BUCKETS] > UINT32_MAX) { words.clear(); ids.clear(); return; }
+    bucket_start.assign(counts.begin(), counts.end());
+    postings.resize(counts[NUM_BUCKETS]);
+    for (size_t i = 0; i < words.size(); ++i) {
+      ForEachBucket(words[i], scratch, [this, &counts, i](uint32_t bucket){
+        postings[counts[bucket]++] = static_cast<uint32_t>(i);
+      });
+    }
+  }
+
+  bool Usable() const { return !ids.empty(); }
+
+  // Can the words containing this needle be looked up?
+  static bool CanFind(std::string_view needle) { return needle.size() >= GRAM_SIZE; }
+
+  // The members containing at least one of the needles; each must pass CanFind().
+  WordSet FindAny(const std::vector<std::string_view> & needles) const {
+    std::vector<id_t> found;
+    for (std::string_view needle : needles) {
+      assert(CanFind(needle));
+      size_t best = Bucket(needle.data());
+      for (size_t pos = 1; pos + GRAM_SIZE <= needle.size(); ++pos) {
+        const size_t bucket = Bucket(needle.data() + pos);
+        if (bucket_start[bucket + 1] - bucket_start[bucket] <
+            bucket_start[best + 1] - bucket_start[best]) best = bucket;
+      }
+      for (size_t i = bucket_start[best]; i < bucket_start[best + 1]; ++i) {
+        const uint32_t word_id = postings[i];
+        if (words[word_id].find(needle) != std::string_view::npos) found.push_back(ids[word_id]);
+      }
+    }
+    return WordSet{std::move(found)};
+  }
+
+  // Count a filter pass over words and return the index of its body, building
+  // it on the pass that reaches INDEX_AFTER_FILTERS.  nullptr means "scan".
+  static std::shared_ptr<const SubstringIndex> Find(const WordSet & words) {
+    if (words.size() < MIN_WORDS || words.IsSpilled()) return nullptr;
+    WordSet::IndexSlot & slot = words.data->index_slot;
+    std::lock_guard<std::mutex> guard(slot.lock);
+    if (slot.index) return slot.index;
+    if (slot.tried || ++slot.num_filters < INDEX_AFTER_FILTERS) return nullptr;
+    slot.tried = true;
+    auto index = std::make_shared<const SubstringIndex>(words);
+    if (index->Usable()) slot.index = index;
+    return slot.index;
+  }
+};
+
+#endif // #ifndef WORDLANG_SUBSTRING_INDEX_HPP_INCLUDE_
@@ -0,0 +1,257 @@
+#ifndef WORDLANG_THREAD_POOL_HPP_INCLUDE_
+#define WORDLANG_THREAD_POOL_HPP_INCLUDE_
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads.  A pool of N threads runs work on N-1
+// workers plus the calling thread, so a pool of 1 runs everything inline.
+class ThreadPool {
+private:
+  std::vector<std::thread> workers{};
+  std::deque<std::function<void()>> tasks{};
+  std::mutex lock{};
+  std::condition_variable wake{};
+  bool stopping = false;
+
+  // Progress of one RunGraph() call, shared with the helpers it starts.
+  struct GraphState {
+    std::function<void(size_t)> * fn = nullptr;     // Only used while tasks are ready.
+    std::vector<std::vector<size_t>> dependents{};  // Tasks waiting on each task.
+    std::vector<size_t> num_waiting{};              // Unfinished dependencies per task.
+    std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> ready{};
+    size_t num_left = 0;                            // Tasks not yet finished.
+    size_t num_running = 0;
+    std::exception_ptr error{};
+    std::mutex lock{};
+    std::condition_variable changed{};
+  };
+
+  // Run ready tasks of a graph, lowest index first, until none are left.  When
+  // a task frees several others, helpers are started for all but one of them.
+  void RunReady(const std::shared_ptr<GraphState> & state) {
+    std::unique_lock<std::mutex> guard(state->lock);
+    while (!state->ready.empty() && !state->error) {
+      const size_t task = state->ready.top();
+      state->ready.pop();
+      ++state->num_running;
+      guard.unlock();
+      std::exception_ptr error;
+      try { (*state->fn)(task); }
+      catch (...) { error = std::current_exception(); }
+      guard.lock();
+      --state->num_running;
+      --state->num_left;
+      if (error && !state->error) state->error = error;
+      size_t num_freed = 0;
+      for (size_t next : state->dependents[task]) {
+        if (--state->num_waiting[next] == 0) { state->ready.push(next); ++num_freed; }
+      }
+      for (size_t i = 1; i < num_freed; ++i) Submit([this, state]{ RunReady(state); });
+      state->changed.notify_all();
+    }
+  }
+
+  void WorkerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this]{ return stopping || !tasks.empty(); });
+        if (tasks.empty()) return;            // Only happens when stopping.
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  explicit ThreadPool(size_t num_threads = DefaultThreads()) {
+    for (size_t i = 1; i < num_threads; ++i) {
+      workers.emplace_back([this]{ WorkerLoop(); });
+    }
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto & worker : workers) worker.join();
+  }
+
+  static size_t DefaultThreads() {
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+  }
+
+  size_t GetNumThreads() const { return workers.size() + 1; }
+
+  // Queue a task for any worker; fire-and-forget.
+  void Submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+  // Call fn(i) for every i in [0, count) and wait for all calls to finish.  The
+  // caller takes part, so nested ParallelFor calls from inside fn cannot deadlock.
+  // If a call throws, no further indices start, and the first exception is
+  // rethrown here once every participant has stopped.
+  //
+  // Indices are scheduled by work stealing: each participant starts with its
+  // own contiguous range and takes indices from the front; once it runs dry it
+  // steals the back half of another participant's range.
+  template <typename FN>
+  void ParallelFor(size_t count, FN fn) {
+    const size_t num_parts = std::min(count, GetNumThreads());
+    if (num_parts <= 1) {
+      for (size_t i = 0; i < count; ++i) fn(i);
+      return;
+    }
+
+    // A range [begin, end) packed into one word so it can be updated with CAS.
+    struct alignas(64) Range { std::atomic<uint64_t> bounds{0}; };
+    struct State {
+      std::vector<Range> ranges;
+      std::atomic<size_t> next_part{1};       // Part 0 belongs to the caller.
+      std::atomic<bool> stop{false};          // Set once a call has thrown.
+      size_t done = 0;
+      size_t active = 0;                      // Participants that may still call fn.
+      std::exception_ptr error{};
+      std::mutex lock{};
+      std::condition_variable finished{};
+      explicit State(size_t num_parts) : ranges(num_parts) { }
+    };
+    auto Pack = [](uint64_t begin, uint64_t end){ return (begin << 32) | end; };
+    assert(count < (uint64_t{1} << 32));
+
+    auto state = std::make_shared<State>(num_parts);
+    for (size_t part = 0; part < num_parts; ++part) {
+      state->ranges[part].bounds = Pack(count * part / num_parts, count * (part + 1) / num_parts);
+    }
+
+    auto run = [state, count, num_parts, &fn, Pack](size_t part) {
+      {
+        std::lock_guard<std::mutex> guard(state->lock);
+        if (state->error) return;           // The caller may already be gone.
+        ++state->active;
+      }
+      size_t completed = 0;
+      auto & own = state->ranges[part].bounds;
+      while (!state->stop.load()) {
+        // Take the next index from the front of our own range.
+        uint64_t bounds = own.load();
+        const uint64_t begin = bounds >> 32, end = bounds & 0xFFFFFFFF;
+        if (begin < end) {
+          if (own.compare_exchange_weak(bounds, Pack(begin + 1, end))) {
+            try {
+              fn(static_cast<size_t>(begin));
+              ++completed;
+            }
+            catch (...) {
+              std::lock_guard<std::mutex> guard(state->lock);
+              if (!state->error) state->error = std::current_exception();
+              state->stop = true;
+            }
+          }
+          continue;
+        }
+        // Out of work: steal the back half of the biggest range we can see.
+        size_t victim = num_parts;
+        uint64_t victim_size = 0;
+        for (size_t i = 0; i < num_parts; ++i) {
+          const uint64_t other = state->ranges[i].bounds.load();
+          const uint64_t other_size = (other & 0xFFFFFFFF) - std::min(other >> 32, other & 0xFFFFFFFF);
+          if (other_size > victim_size) { victim = i; victim_size = other_size; }
+        }
+        if (victim == num_parts) break;     // Nothing left anywhere.
+        auto & target = state->ranges[victim].bounds;
+        uint64_t other = target.load();
+        const uint64_t other_begin = other >> 32, other_end = other & 0xFFFFFFFF;
+        if (other_begin >= other_end) continue;
+        const uint64_t mid = other_begin + (other_end - other_begin) / 2;
+        if (target.compare_exchange_strong(other, Pack(other_begin, mid))) {
+          own.store(Pack(mid, other_end));  // Only thieves of non-empty ranges CAS ours.
+        }
+      }
+      std::lock_guard<std::mutex> guard(state->lock);
+      state->done += completed;
+      --state->active;
+      if (state->done == count || (state->error && !state->active)) state->finished.notify_all();
+    };
+
+    // Helpers that start after all indices are claimed (or after a call threw)
+    // exit without touching fn.
+    for (size_t i = 1; i < num_parts; ++i) {
+      Submit([state, run]{ run(state->next_part++); });
+    }
+    run(0);
+    std::unique_lock<std::mutex> guard(state->lock);
+    state->finished.wait(guard, [&state, count]{
+      return state->error ? state->active == 0 : state->done == count;
+    });
+    if (state->error) std::rethrow_exception(state->error);
+  }
+
+  // Call fn(i) for every task i in [0, deps.size()), where deps[i] lists
+  // earlier tasks that must finish before task i starts, and wait for all
+  // calls to finish.  Tasks start as soon as they are ready; the caller takes
+  // part.  If a task throws, no further tasks start, and the exception is
+  // rethrown here once the running ones are done.
+  template <typename FN>
+  void RunGraph(const std::vector<std::vector<size_t>> & deps, FN fn) {
+    const size_t count = deps.size();
+    if (workers.empty()) {
+      for (size_t i = 0; i < count; ++i) fn(i);
+      return;
+    }
+    std::function<void(size_t)> task_fn(std::move(fn));
+    auto state = std::make_shared<GraphState>();
+    state->fn = &task_fn;
+    state->dependents.resize(count);
+    state->num_waiting.resize(count);
+    state->num_left = count;
+    for (size_t task = 0; task < count; ++task) {
+      state->num_waiting[task] = deps[task].size();
+      for (size_t dep : deps[task]) {
+        assert(dep < task);
+        state->dependents[dep].push_back(task);
+      }
+      if (deps[task].empty()) state->ready.push(task);
+    }
+
+    // Helpers that start after the last task is taken exit without touching fn.
+    const size_t num_helpers = std::min(state->ready.size(), GetNumThreads()) - 1;
+    for (size_t i = 0; i < num_helpers; ++i) Submit([this, state]{ RunReady(state); });
+    std::unique_lock<std::mutex> guard(state->lock);
+    while (true) {
+      guard.unlock();
+      RunReady(state);
+      guard.lock();
+      state->changed.wait(guard, [&state]{
+        if (state->error) return state->num_running == 0;
+        return state->num_left == 0 || !state->ready.empty();
+      });
+      if (state->error || state->num_left == 0) break;
+    }
+    if (state->error) std::rethrow_exception(state->error);
+  }
+};
+
+#endif // #ifndef WORDLANG_THREAD_POOL_HPP_INCLUDE_
@@ -0,0 +1,81 @@
+#ifndef WORDLANG_TOKEN_STREAM_HPP_INCLUDE_
+#define WORDLANG_TOKEN_STREAM_HPP_INCLUDE_
+
+#include <array>
+#include <assert.h>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "lexer.hpp"
+#include "WordLoader.hpp"
+
+// Pull-based token source for the parser.  Tokens are produced on demand from
+// a stable buffer (a mapped script file, or a caller-owned string) and their
+// lexemes are views into that buffer, so nothing is copied per token and only
+// a few tokens of lookahead are held at any time.
+class TokenStream {
+public:
+  static constexpr size_t MAX_LOOKAHEAD = 4;
+
+private:
+  std::unique_ptr<MappedFile> file{};  // Owns the buffer when reading a file.
+  std::string_view source{};
+  emplex::Lexer lexer{};
+
+  std::array<emplex::Token, MAX_LOOKAHEAD> ahead{};   // Ring of upcoming tokens.
+  size_t head = 0;
+  size_t num_ahead = 0;
+  size_t num_tokens = 0;               // Tokens consumed so far, and the total
+  size_t lexeme_bytes = 0;             // size of their lexemes (for --mem-report).
+
+  // Lex the next token the parser should see; ignored tokens are skipped.
+  emplex::Token Lex() {
+    while (true) {
+      lexer.SkipIgnored(source);
+      emplex::Token token = lexer.NextToken(source);
+      if (token == emplex::Lexer::ID__EOF_ || !emplex::Lexer::IgnoreToken(token)) return token;
+    }
+  }
+
+public:
+  // Tokenize a script file; it is mapped for the lifetime of the stream.
+  explicit TokenStream(const std::string & filename)
+    : file(std::make_unique<MappedFile>(filename)), source(file->GetText()) { }
+
+  // Tokenize a caller-owned buffer, which must outlive the stream.
+  explicit TokenStream(std::string_view in_source) : source(in_source) { }
+
+  TokenStream(const TokenStream &) = delete;
+  TokenStream & operator=(const TokenStream &) = delete;
+
+  // Look at an upcoming token without consuming it (0 is the next one).  Past
+  // the end of the input, every token is an _EOF_ token.
+  const emplex::Token & Peek(size_t offset=0) {
+    assert(offset < MAX_LOOKAHEAD);
+    while (num_ahead <= offset) {
+      ahead[(head + num_ahead) % MAX_LOOKAHEAD] = Lex();
+      ++num_ahead;
+    }
+    return ahead[(head + offset) % MAX_LOOKAHEAD];
+  }
+
+  emplex::Token Next() {
+    emplex::Token out = Peek();
+    head = (head + 1) % MAX_LOOKAHEAD;
+    --num_ahead;
+    ++num_tokens;
+    lexeme_bytes += out.lexeme.size();
+    return out;
+  }
+
+  // Lexemes are views into the source, so it is all the text they take.
+  std::string_view GetSource() const { return source; }
+  size_t GetSourceSize() const { return source.size(); }
+  size_t GetNumTokens() const { return num_tokens; }
+  size_t GetLexemeBytes() const { return lexeme_bytes; }
+
+  bool AtEnd() { return Peek() == emplex::Lexer::ID__EOF_; }
+};
+
+#endif // #ifndef WORDLANG_TOKEN_STREAM_HPP_INCLUDE_
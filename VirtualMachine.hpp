@@ -0,0 +1,393 @@
+#ifndef WORDLANG_VIRTUAL_MACHINE_HPP_INCLUDE_
+#define WORDLANG_VIRTUAL_MACHINE_HPP_INCLUDE_
+
+#include <algorithm>
+#include <assert.h>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ExprCache.hpp"
+#include "FilterPipeline.hpp"
+#include "Output.hpp"
+#include "Profiler.hpp"
+#include "ScriptError.hpp"
+#include "Snapshot.hpp"
+#include "ThreadPool.hpp"
+#include "WordLoader.hpp"
+#include "WordSet.hpp"
+
+// Flat, register-based form of a WordLang script.  Registers hold word sets;
+// the first num_vars registers are the script's variables (indexed by their
+// SymbolTable IDs) and the rest are temporaries.  Every temporary is written
+// once and read once, so the VM moves values out of temporaries as it reads
+// them: they are released right away and copy-on-write updates happen in place.
+//
+// A foreach loop is one instruction followed by its body, which ends at the
+// instruction's b.  The body is run once per member of the set, so it is only
+// compiled once; the loop variable is rebound in place for each member.
+//
+// If statements lists the code of each top-level statement, they run on the
+// thread pool as soon as the statements they depend on are done.  Each such
+// statement then has temporaries of its own.
+struct ByteCode {
+  using reg_t = uint32_t;
+
+  enum class OpCode : uint8_t {
+    CONST,        // dest = constants[a]
+    COPY,         // dest = a
+    UNION,        // dest = a + b
+    UNION_ALL,    // dest = union of operands[a .. a+b)
+    DIFFERENCE,   // dest = a - b
+    LOAD,         // dest = load(a)
+    FILTER,       // dest = a | stages[b .. b+c)
+    LOAD_FILTER,  // dest = load(a) | stages[b .. b+c), filtered while reading
+    PRINT,        // print(a)
+    PRINT_FILTER, // print(a | stages[b .. b+c)), written while filtering
+    SAVE,         // save(a, b)
+    FOREACH,      // foreach dest in a: run [pc+1 .. b) for each member
+    PARALLEL_FOREACH,  // as FOREACH, with members spread over the thread pool
+    CACHE_GET,    // if cache slot a is current: dest = its value, jump to b
+    CACHE_PUT     // cache slot a = b (b is left in place)
+  };
+
+  struct Instruction {
+    OpCode op;
+    reg_t dest = 0;
+    reg_t a = 0;
+    reg_t b = 0;
+    reg_t c = 0;
+  };
+
+  struct FilterStage {
+    reg_t needles;        // Register holding the filter words,
+    bool filter_out;
+    bool word = false;    // or, if set, the index of one in needle_words.
+  };
+
+  struct Statement {
+    size_t begin;                       // Code [begin, end) runs the statement.
+    size_t end;
+  };
+
+  std::vector<Instruction> code{};
+  std::vector<size_t> lines{};         // Source line of each instruction.
+  std::vector<WordSet> constants{};
+  std::vector<FilterStage> stages{};
+  std::vector<std::string_view> needle_words{};   // A request's literal filter words.
+  std::vector<reg_t> operands{};       // Operand lists of n-ary instructions.
+  std::vector<std::vector<size_t>> cache_slots{};   // Variables read by each cache slot.
+  std::vector<Statement> statements{};               // Empty: run the code in order.
+  std::vector<std::vector<size_t>> statement_deps{}; // Earlier statements each one waits for.
+  size_t num_vars = 0;
+  size_t num_registers = 0;
+
+  bool IsTemp(reg_t reg) const { return reg >= num_vars; }
+
+  static const char * OpName(OpCode op) {
+    switch (op) {
+    case OpCode::CONST: return "CONST";
+    case OpCode::COPY: return "COPY";
+    case OpCode::UNION: return "UNION";
+    case OpCode::UNION_ALL: return "UNION_ALL";
+    case OpCode::DIFFERENCE: return "DIFFERENCE";
+    case OpCode::LOAD: return "LOAD";
+    case OpCode::FILTER: return "FILTER";
+    case OpCode::LOAD_FILTER: return "LOAD_FILTER";
+    case OpCode::PRINT: return "PRINT";
+    case OpCode::PRINT_FILTER: return "PRINT_FILTER";
+    case OpCode::SAVE: return "SAVE";
+    case OpCode::FOREACH: return "FOREACH";
+    case OpCode::PARALLEL_FOREACH: return "PARALLEL_FOREACH";
+    case OpCode::CACHE_GET: return "CACHE_GET";
+    case OpCode::CACHE_PUT: return "CACHE_PUT";
+    }
+    return "?";
+  }
+
+  void Print(std::ostream & os) const {
+    auto Reg = [this](reg_t reg){
+      return (IsTemp(reg) ? "t" : "v") + std::to_string(IsTemp(reg) ? reg - num_vars : reg);
+    };
+    for (size_t line = 0; line < code.size(); ++line) {
+      const Instruction & inst = code[line];
+      os << line << ": ";
+      switch (inst.op) {
+      case OpCode::CONST:
+        os << Reg(inst.dest) << " = CONST #" << inst.a << " (" << constants[inst.a].size() << " words)";
+        break;
+      case OpCode::COPY: os << Reg(inst.dest) << " = " << Reg(inst.a); break;
+      case OpCode::UNION: os << Reg(inst.dest) << " = " << Reg(inst.a) << " + " << Reg(inst.b); break;
+      case OpCode::UNION_ALL:
+        os << Reg(inst.dest) << " = UNION_ALL";
+        for (size_t i = inst.a; i < inst.a + inst.b; ++i) {
+          os << (i == inst.a ? " " : ", ") << Reg(operands[i]);
+        }
+        break;
+      case OpCode::DIFFERENCE:
+        os << Reg(inst.dest) << " = " << Reg(inst.a) << " - " << Reg(inst.b);
+        break;
+      case OpCode::LOAD: os << Reg(inst.dest) << " = LOAD " << Reg(inst.a); break;
+      case OpCode::FILTER:
+      case OpCode::LOAD_FILTER:
+      case OpCode::PRINT_FILTER:
+        if (inst.op == OpCode::PRINT_FILTER) os << "PRINT " << Reg(inst.a);
+        else os << Reg(inst.dest) << " = " << (inst.op == OpCode::LOAD_FILTER ? "LOAD " : "") << Reg(inst.a);
+        for (size_t i = inst.b; i < inst.b + inst.c; ++i) {
+          os << (stages[i].filter_out ? " | FILTER_OUT " : " | FILTER ");
+          if (stages[i].word) os << '"' << needle_words[stages[i].needles] << '"';
+          else os << Reg(stages[i].needles);
+        }
+        break;
+      case OpCode::PRINT: os << "PRINT " << Reg(inst.a); break;
+      case OpCode::SAVE: os << "SAVE " << Reg(inst.a) << ", " << Reg(inst.b); break;
+      case OpCode::FOREACH:
+      case OpCode::PARALLEL_FOREACH:
+        os << (inst.op == OpCode::FOREACH ? "FOREACH " : "PARALLEL_FOREACH ") << Reg(inst.dest)
+           << " IN " << Reg(inst.a) << " (until " << inst.b << ")";
+        break;
+      case OpCode::CACHE_GET:
+        os << Reg(inst.dest) << " = CACHE_GET #" << inst.a << " (hit: goto " << inst.b << ")";
+        break;
+      case OpCode::CACHE_PUT: os << "CACHE_PUT #" << inst.a << " = " << Reg(inst.b); break;
+      }
+      os << std::endl;
+    }
+  }
+};
+
+class VirtualMachine {
+private:
+  using reg_t = ByteCode::reg_t;
+  using OpCode = ByteCode::OpCode;
+
+  std::vector<WordSet> registers{};
+  ThreadPool & pool;
+  LoadCache * load_cache = nullptr;
+  Profiler * profiler = nullptr;
+  std::vector<size_t> peak_bytes{};    // Most memory each variable has held, while profiling.
+  ExprCache expr_cache{};
+  OutputWriter & output = OutputWriter::Stdout();
+  StringWriter * capture = nullptr;    // Set while running part of a parallel loop.
+
+  // Parallel loops split their members into about this many parts per thread.
+  static constexpr size_t PARTS_PER_THREAD = 4;
+
+  // Read an operand; temporaries are single-use, so take their value.
+  WordSet Take(const ByteCode & program, reg_t reg) {
+    if (program.IsTemp(reg)) return std::move(registers[reg]);
+    return registers[reg];
+  }
+
+  // The filter stages of instruction inst.
+  FilterPipeline MakePipeline(const ByteCode & program, const ByteCode::Instruction & inst) {
+    FilterPipeline pipeline;
+    for (size_t i = inst.b; i < inst.b + inst.c; ++i) {
+      const ByteCode::FilterStage & stage = program.stages[i];
+      if (stage.word) pipeline.AddStage({program.needle_words[stage.needles]}, stage.filter_out);
+      else pipeline.AddStage(Take(program, stage.needles).SortedWords(), stage.filter_out);
+    }
+    return pipeline;
+  }
+
+  template <typename FN>
+  void PrintIf(const WordSet & words, FN test) {
+    if (capture) PrintWordListIf(*capture, words, test);
+    else PrintWordListIf(output, words, test);
+  }
+
+  // Run the body of the parallel loop at pc once for each of ids.  The members
+  // are split into parts, and each part runs on its own VM that starts with a
+  // copy of these registers; the body cannot assign variables from outside the
+  // loop, so no part can see another's changes.  Each part's output is held
+  // until the parts before it are done, so it comes out in loop order.
+  void RunParallel(const ByteCode & program, size_t pc, const std::vector<WordSet::id_t> & ids) {
+    const size_t num_parts = std::min(ids.size(), pool.GetNumThreads() * PARTS_PER_THREAD);
+    std::vector<StringWriter> outputs(num_parts);
+    pool.ParallelFor(num_parts, [&](size_t part){
+      VirtualMachine worker(pool, load_cache);
+      worker.registers = registers;
+      worker.expr_cache.Reset(program.num_vars, program.cache_slots);
+      worker.capture = &outputs[part];
+      for (size_t i = ids.size() * part / num_parts; i < ids.size() * (part + 1) / num_parts; ++i) {
+        worker.RunIteration(program, pc, ids[i]);
+      }
+    });
+    for (const StringWriter & part_output : outputs) {
+      if (capture) capture->Write(part_output.GetText());
+      else output.Write(part_output.GetText());
+    }
+  }
+
+  // Bind the loop variable of the loop at pc to id, then run the body.
+  void RunIteration(const ByteCode & program, size_t pc, WordSet::id_t id) {
+    const ByteCode::Instruction & inst = program.code[pc];
+    registers[inst.dest].AssignID(id);
+    expr_cache.NoteAssign(inst.dest);
+    RunRange(program, pc + 1, inst.b);
+  }
+
+  // Total size of the sets an instruction reads (for profiling).
+  size_t InputSize(const ByteCode & program, const ByteCode::Instruction & inst) const {
+    switch (inst.op) {
+    case OpCode::CONST: return program.constants[inst.a].size();
+    case OpCode::CACHE_GET: return 0;
+    case OpCode::CACHE_PUT: return registers[inst.b].size();
+    case OpCode::UNION:
+    case OpCode::DIFFERENCE:
+    case OpCode::SAVE: return registers[inst.a].size() + registers[inst.b].size();
+    case OpCode::UNION_ALL: {
+      size_t total = 0;
+      for (size_t i = inst.a; i < inst.a + inst.b; ++i) total += registers[program.operands[i]].size();
+      return total;
+    }
+    case OpCode::FILTER:
+    case OpCode::LOAD_FILTER:
+    case OpCode::PRINT_FILTER: {
+      size_t total = registers[inst.a].size();
+      for (size_t i = inst.b; i < inst.b + inst.c; ++i) {
+        const ByteCode::FilterStage & stage = program.stages[i];
+        total += stage.word ? 1 : registers[stage.needles].size();
+      }
+      return total;
+    }
+    default: return registers[inst.a].size();
+    }
+  }
+
+public:
+  VirtualMachine(ThreadPool & pool, LoadCache * load_cache=nullptr)
+    : pool(pool), load_cache(load_cache) { }
+
+  // Record every instruction in profiler (nullptr turns profiling off).
+  void SetProfiler(Profiler * in) { profiler = in; }
+
+  // Send printed lists to out instead of standard output (nullptr to undo).
+  void CaptureOutput(StringWriter * out) { capture = out; }
+
+  WordSet & GetRegister(reg_t reg) { return registers[reg]; }
+
+  // Most bytes a variable's value held during Run() (0 if the profiler was off).
+  size_t GetPeakBytes(reg_t reg) const { return reg < peak_bytes.size() ? peak_bytes[reg] : 0; }
+
+  // Give a variable its value before Run() (other registers start out empty).
+  void SetRegister(reg_t reg, WordSet value) {
+    if (reg >= registers.size()) registers.resize(reg + 1);
+    registers[reg] = std::move(value);
+  }
+  const ExprCache & GetExprCache() const { return expr_cache; }
+
+  void Run(const ByteCode & program) {
+    registers.resize(program.num_registers);
+    expr_cache.Reset(program.num_vars, program.cache_slots);
+    if (profiler) peak_bytes.assign(program.num_vars, 0);
+    if (program.statements.empty()) {
+      RunRange(program, 0, program.code.size());
+      return;
+    }
+    pool.RunGraph(program.statement_deps, [this, &program](size_t i){
+      RunRange(program, program.statements[i].begin, program.statements[i].end);
+    });
+  }
+
+  // Run instructions [begin, end); jumps always stay inside the range.
+  void RunRange(const ByteCode & program, size_t begin, size_t end) {
+    size_t next_pc = begin;
+    for (size_t pc = begin; pc < end; pc = next_pc) {
+      const ByteCode::Instruction & inst = program.code[pc];
+      next_pc = pc + 1;
+      size_t in_words = 0;
+      if (profiler) {
+        in_words = InputSize(program, inst);
+        profiler->Enter();
+      }
+      switch (inst.op) {
+      case OpCode::CONST:
+        registers[inst.dest] = program.constants[inst.a];
+        break;
+      case OpCode::COPY:
+        registers[inst.dest] = Take(program, inst.a);
+        if (!program.IsTemp(inst.dest)) expr_cache.NoteAssign(inst.dest);
+        break;
+      case OpCode::UNION:
+      case OpCode::DIFFERENCE: {
+        WordSet right = Take(program, inst.b);
+        // "x = x + y" has x as both dest and a; take x itself to update it in place.
+        WordSet left = inst.a == inst.dest ? std::move(registers[inst.a]) : Take(program, inst.a);
+        if (inst.op == OpCode::UNION) left.Insert(right);
+        else left.Remove(right);
+        registers[inst.dest] = std::move(left);
+        if (!program.IsTemp(inst.dest)) expr_cache.NoteAssign(inst.dest);
+        break;
+      }
+      case OpCode::UNION_ALL: {
+        std::vector<WordSet> sets;
+        sets.reserve(inst.b);
+        for (size_t i = inst.a; i < inst.a + inst.b; ++i) {
+          sets.push_back(Take(program, program.operands[i]));
+        }
+        registers[inst.dest] = UnionAll(std::move(sets), pool);
+        break;
+      }
+      case OpCode::LOAD:
+        registers[inst.dest] = LoadWordFiles(Take(program, inst.a).SortedWords(), pool, load_cache);
+        break;
+      case OpCode::FILTER:
+      case OpCode::LOAD_FILTER: {
+        WordSet words = Take(program, inst.a);
+        const FilterPipeline pipeline = MakePipeline(program, inst);
+        if (inst.op == OpCode::FILTER) registers[inst.dest] = pipeline.Run(words, pool);
+        else registers[inst.dest] = pipeline.RunOnFiles(words.SortedWords(), pool, load_cache);
+        break;
+      }
+      case OpCode::PRINT:
+        PrintIf(Take(program, inst.a), [](std::string_view){ return true; });
+        break;
+      case OpCode::PRINT_FILTER: {
+        WordSet words = Take(program, inst.a);
+        const FilterPipeline pipeline = MakePipeline(program, inst);
+        PrintIf(words, [&pipeline](std::string_view word){ return pipeline.Test(word); });
+        break;
+      }
+      case OpCode::SAVE: {
+        WordSet words = Take(program, inst.a);
+        const std::string error = SaveSnapshot(words, Take(program, inst.b));
+        if (error.size()) throw ScriptError(program.lines[pc], error);
+        break;
+      }
+      case OpCode::CACHE_GET:
+        if (const WordSet * value = expr_cache.Find(inst.a)) {
+          registers[inst.dest] = *value;
+          next_pc = inst.b;           // Skip the code that computes the value.
+        }
+        break;
+      case OpCode::CACHE_PUT:
+        expr_cache.Store(inst.a, registers[inst.b]);
+        break;
+      case OpCode::FOREACH:
+        for (WordSet::id_t id : Take(program, inst.a).SortedIDs()) RunIteration(program, pc, id);
+        next_pc = inst.b;
+        break;
+      case OpCode::PARALLEL_FOREACH:
+        RunParallel(program, pc, Take(program, inst.a).SortedIDs());
+        next_pc = inst.b;
+        break;
+      }
+      if (profiler) {
+        const bool has_dest = inst.op != OpCode::PRINT && inst.op != OpCode::PRINT_FILTER &&
+                              inst.op != OpCode::SAVE && inst.op != OpCode::CACHE_PUT &&
+                              inst.op != OpCode::FOREACH && inst.op != OpCode::PARALLEL_FOREACH;
+        const size_t out_words = has_dest ? registers[inst.dest].size() : 0;
+        if (has_dest && !program.IsTemp(inst.dest)) {
+          peak_bytes[inst.dest] = std::max(peak_bytes[inst.dest], registers[inst.dest].MemoryBytes());
+        }
+        profiler->Exit(program.lines[pc], ByteCode::OpName(inst.op), out_words,
+                       static_cast<int64_t>(in_words));
+      }
+    }
+  }
+};
+
+#endif // #ifndef WORDLANG_VIRTUAL_MACHINE_HPP_INCLUDE_
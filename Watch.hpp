@@ -0,0 +1,91 @@
+#ifndef WORDLANG_WATCH_HPP_INCLUDE_
+#define WORDLANG_WATCH_HPP_INCLUDE_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "WordLoader.hpp"
+#include "WordSet.hpp"
+
+// Watch mode ("--watch"): the script runs again each time it or a file it
+// loaded changes.  Between runs, a WatchState keeps what each top-level
+// statement did, so a statement whose tree and inputs are unchanged restores
+// its results rather than running again (see WordLang::RunWatched()).
+namespace watch {
+  // What a file looked like: the same device, inode, size and modification
+  // time as LoadCache checks.  A missing file has a stamp of its own.
+  struct FileStamp {
+    bool exists = false;
+    uint64_t device = 0, inode = 0, size = 0;
+    int64_t mtime_sec = 0, mtime_nsec = 0;
+
+    static FileStamp Of(const std::string & filename) {
+      struct stat info;
+      if (stat(filename.c_str(), &info) != 0) return FileStamp{};
+      return FileStamp{true, static_cast<uint64_t>(info.st_dev), static_cast<uint64_t>(info.st_ino),
+                       static_cast<uint64_t>(info.st_size), info.st_mtim.tv_sec, info.st_mtim.tv_nsec};
+    }
+
+    bool operator==(const FileStamp &) const = default;
+  };
+
+  // Files, each with its stamp when it was read.
+  using files_t = std::vector<std::pair<std::string, FileStamp>>;
+
+  inline bool Changed(const files_t & files) {
+    return std::any_of(files.begin(), files.end(), [](const auto & file){
+      return FileStamp::Of(file.first) != file.second;
+    });
+  }
+
+  // Poll until one of files no longer has its stamp.
+  inline void WaitForChange(const files_t & files,
+                            std::chrono::milliseconds interval=std::chrono::milliseconds(100)) {
+    while (!Changed(files)) std::this_thread::sleep_for(interval);
+  }
+}
+
+// What the runs of a watched script keep.
+struct WatchState {
+  // The effect of one run of a statement.
+  struct Entry {
+    uint64_t version = 0;               // Of the values it assigned (unique to this run).
+    watch::files_t files{};             // Loaded, as they were when read.
+    std::vector<WordSet> values{};      // Variables assigned, as listed by the statement.
+    std::string output{};               // Printed.
+  };
+
+  // Entries by statement key: the statement's tree, with variables by name, and
+  // the version of each variable it reads.  Only the last run's entries are
+  // kept (and those of an earlier run that a failed run did not reach).
+  std::unordered_map<std::string, Entry> entries{};
+  uint64_t last_version = 0;
+  watch::files_t failed_files{};       // Loaded by a statement that failed.
+  std::vector<std::string> saved_files{};   // Written by save(); not watched.
+  std::shared_ptr<LoadCache> load_cache{std::make_shared<LoadCache>()};
+
+  // What to watch: the script (stamped before it was read) and every file the
+  // kept entries loaded, except those save() writes.
+  watch::files_t GetWatchedFiles(const std::string & script, const watch::FileStamp & script_stamp) const {
+    watch::files_t files{{script, script_stamp}};
+    auto add = [this, &files](const auto & file){
+      if (std::find(saved_files.begin(), saved_files.end(), file.first) == saved_files.end()) {
+        files.push_back(file);
+      }
+    };
+    for (const auto & [key, entry] : entries) for (const auto & file : entry.files) add(file);
+    for (const auto & file : failed_files) add(file);
+    return files;
+  }
+};
+
+#endif // #ifndef WORDLANG_WATCH_HPP_INCLUDE_
@@ -1,28 +1,57 @@
+#include <algorithm>
 #include <assert.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
 #include <iostream>
-#include <fstream>
-#include <set>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <sys/resource.h>
+
+#include "ExprCache.hpp"
+#include "FilterPipeline.hpp"
 #include "lexer.hpp"
+#include "Output.hpp"
+#include "Profiler.hpp"
+#include "ScriptCache.hpp"
+#include "ScriptError.hpp"
+#include "Server.hpp"
+#include "Snapshot.hpp"
+#include "Spill.hpp"
+#include "ThreadPool.hpp"
+#include "TokenStream.hpp"
+#include "VirtualMachine.hpp"
+#include "Watch.hpp"
+#include "WordLoader.hpp"
+#include "WordSet.hpp"
 
-using words_t = std::set<std::string>;
+using words_t = WordSet;
 
 template <typename... Ts>
-void Error(size_t line_num, Ts... message) {
-  std::cerr << "ERROR (line " << line_num << "): ";
-  (std::cerr << ... << message);
-  std::cerr << std::endl;
-  exit(1);
+[[noreturn]] void Error(size_t line_num, Ts... message) {
+  std::ostringstream os;
+  (os << ... << message);
+  throw ScriptError(line_num, os.str());
 }
 
 template <typename... Ts>
-void Error(emplex::Token token, Ts... message) {
+[[noreturn]] void Error(emplex::Token token, Ts... message) {
   Error(token.line_id, message...);
 }
 
+// AST nodes live in an ASTArena and are linked by pointer: each node knows its
+// first and last child and its next sibling, so adding a child is O(1) and no
+// node ever owns (or copies) another.
 class ASTNode {
 public:
   enum Type {
@@ -34,95 +63,269 @@ public:
     LITERAL,
     LOAD,
     PRINT,
+    SAVE,
     FILTER,
-    FILTER_OUT
+    FILTER_OUT,
+    FOREACH,                          // Children: loop variable, set, body; value: parallel?
+    NEEDLE                            // A request's literal filter word (see ParseFilterWords()).
   };
 private:
   Type type{EMPTY};
   size_t value{0};
+  size_t line{0};                     // Source line the node came from.
+  size_t cache_slot{0};               // 1 + shared result slot, or 0 if none.
   words_t words{};
-  std::vector<ASTNode> children{};
+  std::string_view text{};            // NEEDLE: the word, viewing the request's source.
+  ASTNode * first_child{nullptr};
+  ASTNode * last_child{nullptr};
+  ASTNode * next_sibling{nullptr};
+  size_t num_children{0};
+
+  // Forward iteration over a node's children.
+  template <typename NODE_T>
+  class ChildRange {
+  private:
+    NODE_T * first;
+    size_t count;
+  public:
+    class iterator {
+    private:
+      NODE_T * node;
+    public:
+      iterator(NODE_T * node) : node(node) { }
+      NODE_T & operator*() const { return *node; }
+      NODE_T * operator->() const { return node; }
+      iterator & operator++() { node = node->next_sibling; return *this; }
+      bool operator!=(const iterator & in) const { return node != in.node; }
+      bool operator==(const iterator & in) const { return node == in.node; }
+    };
+    ChildRange(NODE_T * first, size_t count) : first(first), count(count) { }
+    iterator begin() const { return iterator(first); }
+    iterator end() const { return iterator(nullptr); }
+    size_t size() const { return count; }
+  };
 
 public:
   ASTNode(Type type=EMPTY) : type(type) { }
   ASTNode(Type type, size_t value) : type(type), value(value) { }
   ASTNode(Type type, words_t words) : type(type), words(words) { }
-  ASTNode(Type type, ASTNode child) : type(type) { AddChild(child); }
-  ASTNode(Type type, ASTNode child1, ASTNode child2)
+  ASTNode(Type type, std::string_view text) : type(type), text(text) { }
+  ASTNode(Type type, ASTNode * child) : type(type) { AddChild(child); }
+  ASTNode(Type type, ASTNode * child1, ASTNode * child2)
     : type(type) { AddChild(child1); AddChild(child2); }
-  ASTNode(const ASTNode &) = default;
-  ASTNode(ASTNode &&) = default;
-  ASTNode & operator=(const ASTNode &) = default;
-  ASTNode & operator=(ASTNode &&) = default;
+  ASTNode(const ASTNode &) = delete;
+  ASTNode(ASTNode &&) = delete;
+  ASTNode & operator=(const ASTNode &) = delete;
+  ASTNode & operator=(ASTNode &&) = delete;
   ~ASTNode() { }
 
   Type GetType() const { return type; }
+  const char * GetTypeName() const {
+    switch (type) {
+    case EMPTY: return "EMPTY";
+    case STATEMENT_BLOCK: return "STATEMENT_BLOCK";
+    case ASSIGN: return "ASSIGN";
+    case MATH_OP: return "MATH_OP";
+    case VARIABLE: return "VARIABLE";
+    case LITERAL: return "LITERAL";
+    case LOAD: return "LOAD";
+    case PRINT: return "PRINT";
+    case SAVE: return "SAVE";
+    case FILTER: return "FILTER";
+    case FILTER_OUT: return "FILTER_OUT";
+    case FOREACH: return value ? "PARALLEL_FOREACH" : "FOREACH";
+    case NEEDLE: return "NEEDLE";
+    }
+    return "UNKNOWN";
+  }
+  size_t GetLine() const { return line; }
+  size_t GetCacheSlot() const { return cache_slot; }
   size_t GetValue() const { return value; }
   const words_t & GetWords() const { return words; }
-  std::vector<ASTNode> & GetChildren() { return children; }
-  const std::vector<ASTNode> & GetChildren() const { return children; }
+  std::string_view GetText() const { return text; }
+  ChildRange<ASTNode> GetChildren() { return {first_child, num_children}; }
+  ChildRange<const ASTNode> GetChildren() const { return {first_child, num_children}; }
+  size_t GetNumChildren() const { return num_children; }
   ASTNode & GetChild(size_t id) {
-    assert(id < children.size());
-    return children[id];
+    assert(id < num_children);
+    ASTNode * child = first_child;
+    while (id--) child = child->next_sibling;
+    return *child;
+  }
+  const ASTNode & GetChild(size_t id) const {
+    return const_cast<ASTNode *>(this)->GetChild(id);
   }
 
   void SetValue(size_t in) { value = in; }
+  void SetLine(size_t in) { line = in; }
+  void SetCacheSlot(size_t in) { cache_slot = in; }
   void SetWords(words_t in) { words = in; }
-  void AddChild(ASTNode child) {
-    assert(child.GetType() != EMPTY);
-    children.push_back(child);
+  void AddChild(ASTNode * child) {
+    assert(child && child->GetType() != EMPTY);
+    assert(child->next_sibling == nullptr);
+    if (last_child) last_child->next_sibling = child;
+    else first_child = child;
+    last_child = child;
+    ++num_children;
+  }
+
+  // Detach and return all children, to rebuild the node while rewriting the tree.
+  std::vector<ASTNode *> TakeChildren() {
+    std::vector<ASTNode *> out;
+    out.reserve(num_children);
+    for (ASTNode * child = first_child; child; ) {
+      ASTNode * next = child->next_sibling;
+      child->next_sibling = nullptr;
+      out.push_back(child);
+      child = next;
+    }
+    first_child = last_child = nullptr;
+    num_children = 0;
+    return out;
+  }
+};
+
+// Owns every ASTNode of one script.  Nodes are constructed in place in large
+// blocks, so parsing does one allocation per block rather than per node and
+// nodes never move once created.
+class ASTArena {
+private:
+  static constexpr size_t BLOCK_NODES = 1024;
+  struct alignas(ASTNode) Slot { std::byte bytes[sizeof(ASTNode)]; };
+
+  std::vector<std::unique_ptr<Slot[]>> blocks{};
+  size_t block_used{BLOCK_NODES};
+
+public:
+  ASTArena() = default;
+  ASTArena(const ASTArena &) = delete;
+  ASTArena(ASTArena &&) = default;
+  ASTArena & operator=(const ASTArena &) = delete;
+  ASTArena & operator=(ASTArena &&) = default;
+  ~ASTArena() { Clear(); }
+
+  size_t GetNumNodes() const {
+    return blocks.empty() ? 0 : (blocks.size() - 1) * BLOCK_NODES + block_used;
+  }
+  size_t GetNumBlocks() const { return blocks.size(); }
+  size_t GetBytes() const { return blocks.size() * BLOCK_NODES * sizeof(Slot); }
+
+  template <typename... Ts>
+  ASTNode * Make(Ts &&... args) {
+    if (block_used == BLOCK_NODES) {
+      blocks.push_back(std::make_unique<Slot[]>(BLOCK_NODES));
+      block_used = 0;
+    }
+    void * slot = &blocks.back()[block_used];
+    ASTNode * node = new (slot) ASTNode(std::forward<Ts>(args)...);
+    ++block_used;
+    return node;
+  }
+
+  void Clear() {
+    for (size_t block = 0; block < blocks.size(); ++block) {
+      const size_t count = (block + 1 == blocks.size()) ? block_used : BLOCK_NODES;
+      for (size_t i = 0; i < count; ++i) {
+        std::launder(reinterpret_cast<ASTNode *>(&blocks[block][i]))->~ASTNode();
+      }
+    }
+    blocks.clear();
+    block_used = BLOCK_NODES;
   }
 };
 
+// Variables by name.  Each name maps to its stack of live bindings, innermost
+// last, so a lookup is one hash probe however deeply scopes are nested.  Each
+// scope lists the variables declared in it, for leaving it.  A copy is a
+// separate table (a server request starts from a copy of its globals).
 class SymbolTable {
 private:
   struct SymbolInfo {
     std::string name;
     words_t words{};
     size_t declare_line;
+    size_t peak_bytes{0};               // Most memory words has held (for --mem-report).
 
-    SymbolInfo(std::string name, size_t declare_line)
+    SymbolInfo(std::string_view name, size_t declare_line)
       : name(name), declare_line(declare_line) { }
   };
+  struct Binding {
+    size_t depth;                       // Scope the variable was declared in.
+    size_t var_id;
+  };
+  using bindings_t = std::vector<Binding>;
+
+  // Lets the map be searched with a string_view without building a string.
+  struct NameHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+  };
+
   std::vector<SymbolInfo> var_info;
-  using scope_t = std::unordered_map<std::string, size_t>;
-  std::vector<scope_t> scope_stack{1};
+  std::unordered_map<std::string, bindings_t, NameHash, std::equal_to<>> bindings;
+  std::vector<std::vector<size_t>> scope_stack{1};
 
 public:
   static constexpr size_t NO_ID = static_cast<size_t>(-1);
 
   size_t GetNumVars() const { return var_info.size(); }
 
-  size_t GetVarID(std::string name) const {
-    for (auto it = scope_stack.rbegin();
-         it != scope_stack.rend();
-         ++it)
-    {
-      if (it->count(name)) return it->find(name)->second;
-    }
-
-    return NO_ID;
+  size_t GetVarID(std::string_view name) const {
+    auto it = bindings.find(name);
+    if (it == bindings.end() || it->second.empty()) return NO_ID;
+    return it->second.back().var_id;
   }
 
-  bool HasVar(std::string name) const {
+  bool HasVar(std::string_view name) const {
     return (GetVarID(name) != NO_ID);
   }
 
-  size_t AddVar(size_t line_num, std::string name) {
-    auto & scope = scope_stack.back();
-    if (scope.count(name)) {
+  size_t AddVar(size_t line_num, std::string_view name) {
+    const size_t depth = scope_stack.size();
+    auto it = bindings.find(name);
+    if (it == bindings.end()) it = bindings.emplace(name, bindings_t{}).first;
+    bindings_t & stack = it->second;
+    if (!stack.empty() && stack.back().depth == depth) {
       Error(line_num, "Redeclaration of variable '", name, "'.");
     }
     size_t var_id = var_info.size();
     var_info.emplace_back(name, line_num);
-    scope[name] = var_id;
+    stack.push_back(Binding{depth, var_id});
+    scope_stack.back().push_back(var_id);
     return var_id;
   }
 
+  const std::string & GetVarName(size_t id) const {
+    assert(id < var_info.size());
+    return var_info[id].name;
+  }
+
   words_t & VarValue(size_t id) {
     assert(id < var_info.size());
     return var_info[id].words;
   }
+  // Add a variable that is never looked up by name (one of a cached program's).
+  void RestoreVar(std::string_view name, size_t declare_line) { var_info.emplace_back(name, declare_line); }
+
+  const words_t & VarValue(size_t id) const {
+    assert(id < var_info.size());
+    return var_info[id].words;
+  }
+
+  size_t GetDeclareLine(size_t id) const {
+    assert(id < var_info.size());
+    return var_info[id].declare_line;
+  }
+
+  // Record that a variable's value held this many bytes; only the peak is kept.
+  void NoteBytes(size_t id, size_t bytes) {
+    assert(id < var_info.size());
+    var_info[id].peak_bytes = std::max(var_info[id].peak_bytes, bytes);
+  }
+  size_t GetPeakBytes(size_t id) const {
+    assert(id < var_info.size());
+    return var_info[id].peak_bytes;
+  }
 
   void IncScope() {
     scope_stack.emplace_back();
@@ -130,17 +333,48 @@ public:
 
   void DecScope() {
     assert(scope_stack.size() > 1);
+    for (size_t var_id : scope_stack.back()) bindings.find(var_info[var_id].name)->second.pop_back();
     scope_stack.pop_back();
   }
 };
 
 class WordLang {
 private:
-  std::vector<emplex::Token> tokens{};
-  size_t token_id{0};
-  ASTNode root{ASTNode::STATEMENT_BLOCK};
+  std::string source_text{};          // Script text, when a compiled program owns it.
+  TokenStream tokens;
+  ASTArena ast{};
+  ASTNode * root{nullptr};
 
   SymbolTable symbols{};
+  std::shared_ptr<ThreadPool> pool;   // Shared with the requests of a server.
+  size_t num_globals{0};              // Variables that belong to a server's globals.
+
+  ByteCode program{};
+  size_t next_temp{0};                // Temporaries are reused between statements...
+  size_t temp_base{0};                // ...starting here (see Compile()).
+  bool use_tree_walker{false};
+  bool use_optimizer{true};
+  bool optimized{false};
+  bool use_cse{true};
+  bool keep_final_values{false};      // Are variables read after the script ends?
+  bool prepared{false};
+  bool compiled{false};
+  bool has_save{false};               // Can files change while the script runs?
+  bool stream_print{false};           // Print filtered words as they are tested?
+  bool parallel_statements{true};     // Run independent statements at the same time?
+
+  std::shared_ptr<LoadCache> load_cache{std::make_shared<LoadCache>()};
+  StringWriter * capture{nullptr};    // Collects what a server request prints.
+  bool intern_filter_words{true};     // False for server requests (see ParseFilterWords()).
+  ExprCache expr_cache{};                             // Used by the tree walker.
+  std::vector<std::vector<size_t>> cache_slots{};     // Variables read per slot.
+  std::vector<ASTNode *> statements{};                // Scheduled statements (see PlanStatements()).
+  std::vector<std::vector<size_t>> statement_deps{};
+  std::unique_ptr<Profiler> profiler{};
+  bool mem_report{false};             // Track what variables hold (see PrintMemReport())?
+  std::string cached_debug{};         // PrintDebug() output of a cached program (which has no tree).
+  WatchState * watch_state{nullptr};  // Kept between runs in watch mode (see RunWatched())...
+  watch::files_t * watch_loads{nullptr};   // ...and the files the running statement loaded.
 
   // === HELPER FUNCTIONS ===
 
@@ -151,9 +385,9 @@ private:
     return emplex::Lexer::TokenName(id);
   }
 
-  emplex::Token CurToken() const { return tokens[token_id]; }
+  const emplex::Token & CurToken() { return tokens.Peek(); }
 
-  emplex::Token UseToken() { return tokens[token_id++]; }
+  emplex::Token UseToken() { return tokens.Next(); }
 
   emplex::Token UseToken(int required_id, std::string err_message="") {
     if (CurToken() != required_id) {
@@ -170,71 +404,155 @@ private:
 
   bool UseTokenIf(int test_id) {
     if (CurToken() == test_id) {
-      token_id++;
+      tokens.Next();
       return true;
     }
     return false;
   }
 
-  ASTNode MakeVarNode(const emplex::Token & token) {
+  template <typename... Ts>
+  ASTNode * MakeNode(size_t line, Ts &&... args) {
+    ASTNode * node = ast.Make(std::forward<Ts>(args)...);
+    node->SetLine(line);
+    return node;
+  }
+
+  template <typename FN>
+  void PrintIf(const words_t & words, FN test) {
+    if (capture) PrintWordListIf(*capture, words, test);
+    else PrintWordListIf(OutputWriter::Stdout(), words, test);
+  }
+
+  // In watch mode, remember the files a statement loads, as they are now, and
+  // the files save() writes.
+  void NoteLoads(const words_t & filenames) {
+    if (!watch_loads) return;
+    for (std::string_view name : filenames.SortedWords()) {
+      watch_loads->emplace_back(std::string(name), watch::FileStamp::Of(std::string(name)));
+    }
+  }
+  void NoteSaves(const words_t & filenames) {
+    if (!watch_state) return;
+    std::vector<std::string> & saved = watch_state->saved_files;
+    for (std::string_view name : filenames.SortedWords()) {
+      if (std::find(saved.begin(), saved.end(), name) == saved.end()) saved.emplace_back(name);
+    }
+  }
+
+  ASTNode * MakeVarNode(const emplex::Token & token) {
     size_t var_id = symbols.GetVarID(token.lexeme);
-    assert(var_id < symbols.GetNumVars());
-    ASTNode out(ASTNode::VARIABLE);
-    out.SetValue(var_id);
-    return out;
+    if (var_id == SymbolTable::NO_ID) {
+      Error(token.line_id, "Unknown variable '", token.lexeme, "'.");
+    }
+    return MakeNode(token.line_id, ASTNode::VARIABLE, var_id);
   }
 
 public:
-  WordLang(std::string filename) {
-    std::ifstream file(filename);
-    emplex::Lexer lexer;
-    tokens = lexer.Tokenize(file);
+  // Read a script file.  Change any settings, then call Parse() (or ReadScriptCache()).
+  WordLang(std::string filename, size_t num_threads=ThreadPool::DefaultThreads())
+    : tokens(filename), pool(std::make_shared<ThreadPool>(num_threads)) { }
 
+  // A server request: a script fragment run against the final values of a
+  // globals script that has already run.  The fragment gets a scope of its own
+  // inside the globals' scope and may read their variables but not assign them,
+  // so any number of requests can run at once.  It shares the globals' thread
+  // pool and load cache, and prints to out.
+  WordLang(std::string_view source, const WordLang & globals, StringWriter & out)
+    : tokens(source), symbols(globals.symbols), pool(globals.pool),
+      num_globals(globals.symbols.GetNumVars()), use_tree_walker(globals.use_tree_walker),
+      use_optimizer(globals.use_optimizer), use_cse(globals.use_cse),
+      stream_print(globals.stream_print), parallel_statements(globals.parallel_statements), load_cache(globals.load_cache), capture(&out)
+  {
+    symbols.IncScope();
+    intern_filter_words = false;
     Parse();
+    if (const ASTNode * assign = FindAssignBelow(*root, num_globals)) {
+      Error(assign->GetLine(), "A request cannot assign to global variable '",
+            symbols.GetVarName(assign->GetChild(0).GetValue()), "'.");
+    }
+  }
+
+  // A program for embedding (see Compile()): the script may read the named
+  // inputs, which are declared in a scope around it, but not assign them.
+  WordLang(std::string source, const std::vector<std::string> & inputs,
+           std::shared_ptr<ThreadPool> in_pool)
+    : source_text(std::move(source)), tokens(std::string_view(source_text)), pool(std::move(in_pool))
+  {
+    for (const std::string & name : inputs) symbols.AddVar(0, name);
+    num_globals = inputs.size();
+    symbols.IncScope();
+    Parse();
+    if (const ASTNode * assign = FindAssignBelow(*root, num_globals)) {
+      Error(assign->GetLine(), "A script cannot assign to input '",
+            symbols.GetVarName(assign->GetChild(0).GetValue()), "'.");
+    }
+    Compile();
   }
 
+  // Parsing builds nodes in the arena; a nullptr result means "no node"
+  // (e.g., a declaration without an initial value).
   void Parse() {
-    while (token_id < tokens.size()) {
-      ASTNode cur_node = ParseStatement();
-      if (cur_node.GetType()) root.AddChild(cur_node);
+    root = MakeNode(1, ASTNode::STATEMENT_BLOCK);
+    while (!tokens.AtEnd()) {
+      ASTNode * cur_node = ParseStatement();
+      if (cur_node) root->AddChild(cur_node);
     }
   }
 
-  ASTNode ParseStatement() {
+  ASTNode * ParseStatement() {
     switch (CurToken()) {
     using namespace emplex;
     case Lexer::ID_PRINT: return ParsePrint();
+    case Lexer::ID_SAVE: return ParseSave();
     case Lexer::ID_TYPE: return ParseDeclare();
     case Lexer::ID_FOREACH: return ParseForeach();
+    case Lexer::ID_PARALLEL: return ParseForeach();
     // case Lexer::ID_IF: return ParseIf();
     // case Lexer::ID_WHILE: return ParseWhile();
     case '{': return ParseStatementBlock();
-    case ';': return ASTNode{};
-    default:
-      return ParseExpression();
+    case ';': UseToken(); return nullptr;
+    default: {
+      ASTNode * expr_node = ParseExpression();
+      UseToken(';');
+      return expr_node;
+    }
     }
   }
 
-  ASTNode ParsePrint() {
-    ASTNode print_node(ASTNode::PRINT);
+  // print(a, b, ...); the parentheses may be left off: print a, b;
+  ASTNode * ParsePrint() {
+    auto print_token = UseToken(emplex::Lexer::ID_PRINT);
+    ASTNode * print_node = MakeNode(print_token.line_id, ASTNode::PRINT);
 
-    UseToken(emplex::Lexer::ID_PRINT);
-    UseToken('(');
+    const bool parens = UseTokenIf('(');
     do {
-      print_node.AddChild( ParseExpression() );
+      print_node->AddChild( ParseExpression() );
     } while (UseTokenIf(','));
-    UseToken(')');
+    if (parens) UseToken(')');
     UseToken(';');
 
     return print_node;
   }
 
-  ASTNode ParseDeclare() {
-    auto type_token = UseToken(emplex::Lexer::ID_TYPE);
+  // save(words, filename);
+  ASTNode * ParseSave() {
+    auto save_token = UseToken(emplex::Lexer::ID_SAVE);
+    UseToken('(');
+    ASTNode * words_node = ParseExpression();
+    UseToken(',');
+    ASTNode * filename_node = ParseExpression();
+    UseToken(')');
+    UseToken(';');
+    has_save = true;
+    return MakeNode(save_token.line_id, ASTNode::SAVE, words_node, filename_node);
+  }
+
+  ASTNode * ParseDeclare() {
+    UseToken(emplex::Lexer::ID_TYPE);
     auto var_token = UseToken(emplex::Lexer::ID_ID);
-    symbols.AddVar(var_token, var_token.lexeme);
+    symbols.AddVar(var_token.line_id, var_token.lexeme);
 
-    if (UseTokenIf(';')) return ASTNode{};
+    if (UseTokenIf(';')) return nullptr;
 
     UseToken('=', "Expected ';' or '='.");
 
@@ -242,67 +560,106 @@ public:
     auto rhs_node = ParseExpression();
     UseToken(';');
 
-    return ASTNode{ASTNode::ASSIGN, lhs_node, rhs_node};
+    return MakeNode(var_token.line_id, ASTNode::ASSIGN, lhs_node, rhs_node);
   }
 
-  ASTNode ParseForeach() {
-    return ASTNode{};
+  // [parallel] foreach word in words: statement
+  //
+  // The body runs once for each member of words, in sorted order, with word
+  // bound to the one-word set of that member.  The loop variable is declared in
+  // a scope of its own around the body.  A parallel loop may run its iterations
+  // at the same time, so its body may not save() or assign to variables
+  // declared outside the loop; what it prints still comes out in loop order.
+  ASTNode * ParseForeach() {
+    const bool parallel = UseTokenIf(emplex::Lexer::ID_PARALLEL);
+    auto foreach_token = UseToken(emplex::Lexer::ID_FOREACH);
+    auto var_token = UseToken(emplex::Lexer::ID_ID);
+    UseToken(emplex::Lexer::ID_IN);
+    ASTNode * words_node = ParseExpression();
+    UseToken(':');
+
+    symbols.IncScope();
+    const size_t var_id = symbols.AddVar(var_token.line_id, var_token.lexeme);
+    ASTNode * var_node = MakeVarNode(var_token);
+    ASTNode * body = ParseStatement();
+    symbols.DecScope();
+    if (!body) body = MakeNode(foreach_token.line_id, ASTNode::STATEMENT_BLOCK);
+
+    if (parallel) {
+      if (HasType(*body, ASTNode::SAVE)) {
+        Error(foreach_token, "A parallel foreach cannot save().");
+      }
+      std::vector<size_t> reads, writes;
+      CollectReadsWrites(*body, reads, writes);
+      for (size_t id : writes) {
+        if (id >= var_id) continue;     // Declared inside the loop.
+        Error(foreach_token, "A parallel foreach cannot assign to '", symbols.GetVarName(id),
+              "', which is declared outside the loop.");
+      }
+    }
+
+    ASTNode * out_node = MakeNode(foreach_token.line_id, ASTNode::FOREACH, var_node, words_node);
+    out_node->AddChild(body);
+    out_node->SetValue(parallel);
+    return out_node;
   }
 
-  ASTNode ParseStatementBlock() {
-    ASTNode out_node{ASTNode::STATEMENT_BLOCK};
-    UseToken('{');
+  ASTNode * ParseStatementBlock() {
+    auto block_token = UseToken('{');
+    ASTNode * out_node = MakeNode(block_token.line_id, ASTNode::STATEMENT_BLOCK);
     symbols.IncScope();
     while (CurToken() != '}') {
-      out_node.AddChild( ParseStatement() );
+      ASTNode * child = ParseStatement();
+      if (child) out_node->AddChild(child);
     }
     symbols.DecScope();
     UseToken('}');
     return out_node;
   }
 
-  ASTNode ParseExpression() {
+  ASTNode * ParseExpression() {
     return ParseExpressionAssign();
     // ASTNode term_node = ParseTerm();
     // @CAO - Need to handle operators.
     // return term_node;
   }
 
-  ASTNode ParseExpressionAssign() {
-    ASTNode lhs = ParseExpressionAddSub();
-    if (UseTokenIf('=')) {
-      ASTNode rhs = ParseExpressionAssign();  // Right associative.
-      return ASTNode(ASTNode::ASSIGN, lhs, rhs);
+  ASTNode * ParseExpressionAssign() {
+    ASTNode * lhs = ParseExpressionAddSub();
+    if (CurToken() == '=') {
+      auto token = UseToken();
+      ASTNode * rhs = ParseExpressionAssign();  // Right associative.
+      return MakeNode(token.line_id, ASTNode::ASSIGN, lhs, rhs);
     }
     return lhs;
   }
 
-  ASTNode ParseExpressionAddSub() {
-    ASTNode lhs = ParseExpressionPipe();
+  ASTNode * ParseExpressionAddSub() {
+    ASTNode * lhs = ParseExpressionPipe();
     while (CurToken() == '+' || CurToken() == '-') {
-      int token = UseToken();
-      ASTNode rhs = ParseExpressionPipe();
-      lhs = ASTNode{ASTNode::MATH_OP, lhs, rhs};
-      lhs.SetValue(token);
+      auto token = UseToken();
+      ASTNode * rhs = ParseExpressionPipe();
+      lhs = MakeNode(token.line_id, ASTNode::MATH_OP, lhs, rhs);
+      lhs->SetValue(token);
     }
     return lhs;
   }
 
-  ASTNode ParseExpressionPipe() {
-    ASTNode lhs = ParseTerm();
+  ASTNode * ParseExpressionPipe() {
+    ASTNode * lhs = ParseTerm();
     while (UseTokenIf('|')) {
       auto token = UseToken();
       UseToken('(');
-      ASTNode filter_ast = ParseExpression();
+      ASTNode * filter_ast = ParseFilterWords();
       UseToken(')');
 
       switch (token) {
       using namespace emplex;
       case Lexer::ID_FILTER:
-        lhs = ASTNode(ASTNode::FILTER, lhs, filter_ast);
+        lhs = MakeNode(token.line_id, ASTNode::FILTER, lhs, filter_ast);
         break;
       case Lexer::ID_FILTER_OUT:
-        lhs = ASTNode(ASTNode::FILTER_OUT, lhs, filter_ast);
+        lhs = MakeNode(token.line_id, ASTNode::FILTER_OUT, lhs, filter_ast);
         break;
       default:
         Error(token, "Unexpected symbol ", TokenName(token));
@@ -311,7 +668,19 @@ public:
     return lhs;
   }
 
-  ASTNode ParseTerm() {
+  // The words of a filter.  A request's literal word is matched as it is in the
+  // source: interned words are never freed, so a server that interned every
+  // request's words would keep growing.  Anything else is an expression.
+  ASTNode * ParseFilterWords() {
+    using namespace emplex;
+    if (intern_filter_words || CurToken() != Lexer::ID_STRING || tokens.Peek(1) != ')') {
+      return ParseExpression();
+    }
+    auto token = UseToken();
+    return MakeNode(token.line_id, ASTNode::NEEDLE, token.lexeme.substr(1,token.lexeme.size()-2));
+  }
+
+  ASTNode * ParseTerm() {
     auto token = UseToken();
 
     switch (token) {
@@ -320,17 +689,16 @@ public:
       return MakeVarNode(token);
     case Lexer::ID_LOAD: {   // Load Command
       UseToken('(');
-      ASTNode arg_node = ParseExpression();
+      ASTNode * arg_node = ParseExpression();
       UseToken(')');
-      return ASTNode{ASTNode::LOAD, arg_node};
+      return MakeNode(token.line_id, ASTNode::LOAD, arg_node);
     }
     case Lexer::ID_STRING: { // String literal
-      words_t words;
-      words.insert(token.lexeme.substr(1,token.lexeme.size()-2));  // @CAO Deal with escape chars
-      return ASTNode{ASTNode::LITERAL, words};
+      words_t words{token.lexeme.substr(1,token.lexeme.size()-2)};  // @CAO Deal with escape chars
+      return MakeNode(token.line_id, ASTNode::LITERAL, words);
     }
     case '(': {
-      ASTNode out_node = ParseExpression();
+      ASTNode * out_node = ParseExpression();
       UseToken(')');
       return out_node;
     }
@@ -338,12 +706,32 @@ public:
       Error(token, "Expected expression. Found ", TokenName(token), ".");
     }
 
-    return ASTNode{};
+    return nullptr;
   }
 
+  // Evaluate a node, recording it if the profiler is on.
   words_t Run(ASTNode & node) {
+    if (!profiler) return RunCached(node);
+    profiler->Enter();
+    words_t out_words = RunCached(node);
+    profiler->Exit(node.GetLine(), node.GetTypeName(), out_words.size());
+    return out_words;
+  }
+
+  // Reuse the value of a repeated expression if its inputs have not changed.
+  words_t RunCached(ASTNode & node) {
+    if (!node.GetCacheSlot()) return RunNode(node);
+    const size_t slot = node.GetCacheSlot() - 1;
+    if (const words_t * value = expr_cache.Find(slot)) return *value;
+    words_t out_words = RunNode(node);
+    expr_cache.Store(slot, out_words);
+    return out_words;
+  }
+
+  // Word sets are shared copy-on-write handles, so reading a variable or
+  // literal and returning results by value are O(1).
+  words_t RunNode(ASTNode & node) {
     words_t out_words;
-    bool filter_out = false;
 
     switch (node.GetType()) {
     case ASTNode::EMPTY:
@@ -357,17 +745,33 @@ public:
       assert(node.GetChildren().size() == 2);
       assert(node.GetChild(0).GetType() == ASTNode::VARIABLE);
       size_t var_id = node.GetChild(0).GetValue();
-      return symbols.VarValue(var_id) = Run(node.GetChild(1));
+      if (IsSelfUpdate(node)) {           // Update the variable's own set in place.
+        ASTNode & op_node = node.GetChild(1);
+        words_t right = Run(op_node.GetChild(1));
+        words_t & var = symbols.VarValue(var_id);
+        if (op_node.GetValue() == '+') var.Insert(right);
+        else var.Remove(right);
+        expr_cache.NoteAssign(var_id);
+        if (mem_report) symbols.NoteBytes(var_id, var.MemoryBytes());
+        return var;
+      }
+      words_t value = Run(node.GetChild(1));
+      expr_cache.NoteAssign(var_id);
+      if (mem_report) symbols.NoteBytes(var_id, value.MemoryBytes());
+      return symbols.VarValue(var_id) = value;
     }
     case ASTNode::MATH_OP: {
+      if (node.GetNumChildren() > 2) {     // Flattened union (see SimplifyUnion).
+        std::vector<words_t> sets;
+        for (ASTNode & child : node.GetChildren()) sets.push_back(Run(child));
+        return UnionAll(std::move(sets), *pool);
+      }
       assert(node.GetChildren().size() == 2);
       words_t left = Run(node.GetChild(0));
       words_t right = Run(node.GetChild(1));
-      if (node.GetValue() == '+') {
-        for (std::string word : right) left.insert(word);
-      } else if (node.GetValue() == '-') {
-        for (std::string word : right) left.erase(word);
-      }
+      // Updates happen in place when left is not shared (copy-on-write).
+      if (node.GetValue() == '+') left.Insert(right);
+      else if (node.GetValue() == '-') left.Remove(right);
       return left;
     }    
     case ASTNode::VARIABLE:
@@ -376,115 +780,1669 @@ public:
     case ASTNode::LITERAL:
       assert(node.GetChildren().size() == 0);
       return node.GetWords();
+    case ASTNode::NEEDLE:            // Only read as a set if the tree was rewritten.
+      return words_t{node.GetText()};
     case ASTNode::LOAD: {
       assert(node.GetChildren().size() == 1);
       auto filenames = Run(node.GetChild(0));
-      std::string word;
-      for (auto name : filenames) {
-        std::ifstream file(name);
-        while (file >> word) {
-          out_words.insert(word);
-        }
-      }
+      NoteLoads(filenames);
+      out_words = LoadWordFiles(filenames.SortedWords(), *pool, load_cache.get());
       break;
     }
     case ASTNode::PRINT:
       for (ASTNode & child : node.GetChildren()) {
-        words_t words = Run(child);
-        std::cout << "[";
-        for (const std::string & word : words) {
-          std::cout << "," << word;
+        if (stream_print && IsFilter(&child) && !child.GetCacheSlot()) {
+          words_t words;
+          const FilterPipeline pipeline = RunFilterChain(child, words, false);
+          PrintIf(words, [&pipeline](std::string_view word){ return pipeline.Test(word); });
         }
-        std::cout << " ]" << std::endl;
+        else PrintIf(Run(child), [](std::string_view){ return true; });
       }
       break;
+    case ASTNode::SAVE: {
+      assert(node.GetChildren().size() == 2);
+      words_t words = Run(node.GetChild(0));
+      const words_t filenames = Run(node.GetChild(1));
+      NoteSaves(filenames);
+      const std::string error = SaveSnapshot(words, filenames);
+      if (error.size()) Error(node.GetLine(), error);
+      break;
+    }
     case ASTNode::FILTER_OUT:
-      filter_out = true;
-      [[fallthrough]];
     case ASTNode::FILTER: {
-      assert(node.GetChildren().size() == 2);
-      words_t words = Run(node.GetChild(0));      // Words to be processed (left of the |).
-      words_t filters = Run(node.GetChild(1));    // Filter to apply.
-      // Test each word to see if it passes the filters.
-      for (std::string word : words) {
-        // Loop through each filter, applying it.
-        bool match = false;
-        for (std::string filter : filters) {
-          if (word.find(filter) != std::string::npos) {
-            match = true;
-            break;
+      words_t words;
+      const FilterPipeline pipeline = RunFilterChain(node, words, true);
+      if (IsFilteredLoad(node)) {
+        NoteLoads(words);
+        out_words = pipeline.RunOnFiles(words.SortedWords(), *pool, load_cache.get());
+      }
+      else out_words = pipeline.Run(words, *pool);
+      break;
+    }
+    case ASTNode::FOREACH: {
+      // A parallel loop runs in order here; its iterations cannot affect each other.
+      assert(node.GetChildren().size() == 3);
+      const size_t var_id = node.GetChild(0).GetValue();
+      for (words_t::id_t id : Run(node.GetChild(1)).SortedIDs()) {
+        symbols.VarValue(var_id).AssignID(id);
+        expr_cache.NoteAssign(var_id);
+        Run(node.GetChild(2));
+      }
+      break;
+    }
+    }
+
+    return out_words;
+  }
+
+  // Fuse a filter with any filters directly beneath it (the earlier stages of a
+  // "|" chain) so that the whole chain is a single pass.  Sets input to the
+  // words left of the first "|" and returns the stages.  If from_files is set
+  // and the chain starts with load(...), input is the filenames instead, so the
+  // files can be filtered while they are read (see LoadWordFilesIf).
+  FilterPipeline RunFilterChain(ASTNode & node, words_t & input, bool from_files) {
+    std::vector<ASTNode *> stages;
+    ASTNode * source = &node;
+    while (IsFilter(source)) {
+      assert(source->GetChildren().size() == 2);
+      stages.push_back(source);
+      source = &source->GetChild(0);
+    }
+    const bool stream = from_files && source->GetType() == ASTNode::LOAD;
+    input = Run(stream ? source->GetChild(0) : *source);
+    FilterPipeline pipeline;
+    for (auto it = stages.rbegin(); it != stages.rend(); ++it) {
+      ASTNode & filters = (*it)->GetChild(1);     // Filter to apply.
+      // If we are filtering, keep words that DO match; filtering OUT keeps the rest.
+      const bool filter_out = (*it)->GetType() == ASTNode::FILTER_OUT;
+      if (IsNeedle(&filters)) pipeline.AddStage({filters.GetText()}, filter_out);
+      else pipeline.AddStage(Run(filters).SortedWords(), filter_out);
+    }
+    return pipeline;
+  }
+
+  // === OPTIMIZER ===
+  // Simplify the tree in place before it is run.  Subtrees are only dropped or
+  // evaluated in a different order when they contain no assignment, so results
+  // and the order of side effects are unchanged.
+
+  static bool IsLiteral(const ASTNode * node) { return node->GetType() == ASTNode::LITERAL; }
+  static bool IsNeedle(const ASTNode * node) { return node->GetType() == ASTNode::NEEDLE; }
+  static bool IsFilter(const ASTNode * node) {
+    return node->GetType() == ASTNode::FILTER || node->GetType() == ASTNode::FILTER_OUT;
+  }
+
+  static bool SameTree(const ASTNode & a, const ASTNode & b) {
+    if (a.GetType() != b.GetType() || a.GetValue() != b.GetValue() ||
+        a.GetNumChildren() != b.GetNumChildren()) return false;
+    if (a.GetType() == ASTNode::LITERAL && !(a.GetWords() == b.GetWords())) return false;
+    if (a.GetType() == ASTNode::NEEDLE && a.GetText() != b.GetText()) return false;
+    auto b_child = b.GetChildren().begin();
+    for (const ASTNode & a_child : a.GetChildren()) {
+      if (!SameTree(a_child, *b_child)) return false;
+      ++b_child;
+    }
+    return true;
+  }
+
+  ASTNode * Simplify(ASTNode * node) {
+    std::vector<ASTNode *> children = node->TakeChildren();
+    for (ASTNode *& child : children) child = Simplify(child);
+
+    switch (node->GetType()) {
+    case ASTNode::MATH_OP:
+      if (node->GetValue() == '+') return SimplifyUnion(node, children);
+      return SimplifyDifference(node, children[0], children[1]);
+    case ASTNode::FILTER:
+    case ASTNode::FILTER_OUT:
+      return SimplifyFilter(node, children[0], children[1]);
+    default:
+      for (ASTNode * child : children) node->AddChild(child);
+      return node;
+    }
+  }
+
+  // Flatten nested unions into one n-ary union (a single k-way merge) and
+  // combine all of its literal operands into one.
+  ASTNode * SimplifyUnion(ASTNode * node, const std::vector<ASTNode *> & children) {
+    std::vector<ASTNode *> operands;
+    ASTNode * literal = nullptr;
+    for (ASTNode * child : children) {
+      std::vector<ASTNode *> parts{child};
+      if (child->GetType() == ASTNode::MATH_OP && child->GetValue() == '+') {
+        parts = child->TakeChildren();
+      }
+      for (ASTNode * part : parts) {
+        if (!IsLiteral(part)) operands.push_back(part);
+        else if (!literal) { literal = part; operands.push_back(part); }
+        else literal->SetWords(literal->GetWords().Union(part->GetWords()));
+      }
+    }
+    if (literal && literal->GetWords().empty() && operands.size() > 1) {
+      operands.erase(std::find(operands.begin(), operands.end(), literal));
+    }
+    if (operands.size() == 1) return operands[0];
+    for (ASTNode * operand : operands) node->AddChild(operand);
+    return node;
+  }
+
+  ASTNode * SimplifyDifference(ASTNode * node, ASTNode * left, ASTNode * right) {
+    if (IsLiteral(left) && IsLiteral(right)) {
+      left->SetWords(left->GetWords().Difference(right->GetWords()));
+      return left;
+    }
+    if (IsLiteral(right) && right->GetWords().empty()) return left;
+    if (!HasAssign(*left) && SameTree(*left, *right)) {       // x - x
+      return MakeNode(node->GetLine(), ASTNode::LITERAL, words_t{});
+    }
+    node->AddChild(left);
+    node->AddChild(right);
+    return node;
+  }
+
+  ASTNode * SimplifyFilter(ASTNode * node, ASTNode * source, ASTNode * needles) {
+    const bool filter_out = node->GetType() == ASTNode::FILTER_OUT;
+    if (IsLiteral(source) && (IsLiteral(needles) || IsNeedle(needles))) {
+      FilterPipeline pipeline;
+      if (IsNeedle(needles)) pipeline.AddStage({needles->GetText()}, filter_out);
+      else pipeline.AddStage(needles->GetWords().SortedWords(), filter_out);
+      source->SetWords(pipeline.Run(source->GetWords(), *pool));
+      return source;
+    }
+
+    // Repeating an earlier stage of the same chain has no effect, as long as
+    // nothing evaluated in between can change what the needles evaluate to.
+    if (!HasAssign(*needles)) {
+      for (const ASTNode * stage = source; IsFilter(stage); stage = &stage->GetChild(0)) {
+        if (stage->GetType() == node->GetType() && SameTree(stage->GetChild(1), *needles)) {
+          return source;
+        }
+        if (HasAssign(stage->GetChild(1))) break;
+      }
+    }
+
+    // x | filter_out(a) | filter_out(b) is x | filter_out(a + b).  (Not for a
+    // request's literal words, which the union would intern.)
+    if (filter_out && source->GetType() == ASTNode::FILTER_OUT &&
+        !IsNeedle(needles) && !IsNeedle(&source->GetChild(1))) {
+      std::vector<ASTNode *> parts = source->TakeChildren();
+      ASTNode * merged = MakeNode(needles->GetLine(), ASTNode::MATH_OP, size_t{'+'});
+      source->AddChild(parts[0]);
+      source->AddChild(SimplifyUnion(merged, {parts[1], needles}));
+      return source;
+    }
+
+    node->AddChild(source);
+    node->AddChild(needles);
+    return node;
+  }
+
+  // Variables an expression reads (assignment targets excluded) and writes.  A
+  // loop writes its variable, and everything its body may write.
+  static void CollectReadsWrites(const ASTNode & node, std::vector<size_t> & reads,
+                                 std::vector<size_t> & writes) {
+    if (node.GetType() == ASTNode::ASSIGN || node.GetType() == ASTNode::FOREACH) {
+      writes.push_back(node.GetChild(0).GetValue());
+      for (const ASTNode & child : node.GetChildren()) {
+        if (&child != &node.GetChild(0)) CollectReadsWrites(child, reads, writes);
+      }
+      return;
+    }
+    if (node.GetType() == ASTNode::VARIABLE) reads.push_back(node.GetValue());
+    for (const ASTNode & child : node.GetChildren()) CollectReadsWrites(child, reads, writes);
+  }
+
+  // An assignment in node to a variable with an ID below limit, or nullptr.
+  static const ASTNode * FindAssignBelow(const ASTNode & node, size_t limit) {
+    if (node.GetType() == ASTNode::ASSIGN && node.GetChild(0).GetValue() < limit) return &node;
+    for (const ASTNode & child : node.GetChildren()) {
+      if (const ASTNode * found = FindAssignBelow(child, limit)) return found;
+    }
+    return nullptr;
+  }
+
+  // Every statement in a block, with nested blocks flattened, in execution order.
+  static void ListStatements(ASTNode & block, std::vector<ASTNode *> & out) {
+    for (ASTNode & statement : block.GetChildren()) {
+      if (statement.GetType() == ASTNode::STATEMENT_BLOCK) ListStatements(statement, out);
+      else out.push_back(&statement);
+    }
+  }
+
+  static void DropStatements(ASTNode & block, const std::vector<ASTNode *> & dropped) {
+    for (ASTNode * statement : block.TakeChildren()) {
+      if (std::find(dropped.begin(), dropped.end(), statement) != dropped.end()) continue;
+      if (statement->GetType() == ASTNode::STATEMENT_BLOCK) DropStatements(*statement, dropped);
+      block.AddChild(statement);
+    }
+  }
+
+  // Is this load(...), possibly followed by filters?
+  static bool IsFilteredLoad(const ASTNode & node) {
+    const ASTNode * source = &node;
+    while (IsFilter(source)) source = &source->GetChild(0);
+    return source->GetType() == ASTNode::LOAD;
+  }
+
+  // A filter chain inside node whose source is a read of var_id.
+  static ASTNode * FindFilterOf(ASTNode & node, size_t var_id) {
+    if (IsFilter(&node) && node.GetChild(0).GetType() == ASTNode::VARIABLE &&
+        node.GetChild(0).GetValue() == var_id) return &node;
+    for (ASTNode & child : node.GetChildren()) {
+      if (ASTNode * found = FindFilterOf(child, var_id)) return found;
+    }
+    return nullptr;
+  }
+
+  // Values are computed where they are needed rather than where they are
+  // assigned: "v = load(...) | ...", read once later as the source of a filter
+  // chain, moves into that chain.  The combined chain is then filtered while the
+  // files are read, so the full loaded set is never built.  Returns whether
+  // anything moved.
+  bool DeferLoads() {
+    std::vector<ASTNode *> statements;
+    ListStatements(*root, statements);
+    const size_t num_statements = statements.size();
+    std::vector<std::vector<size_t>> reads(num_statements), writes(num_statements);
+    for (size_t i = 0; i < num_statements; ++i) {
+      CollectReadsWrites(*statements[i], reads[i], writes[i]);
+    }
+    auto Has = [](const std::vector<size_t> & vars, size_t var_id){
+      return std::find(vars.begin(), vars.end(), var_id) != vars.end();
+    };
+
+    std::vector<ASTNode *> deferred;
+    for (size_t i = 0; i < num_statements; ++i) {
+      ASTNode & def = *statements[i];
+      if (def.GetType() != ASTNode::ASSIGN || !IsFilteredLoad(def.GetChild(1)) ||
+          HasAssign(def.GetChild(1))) continue;
+      const size_t var_id = def.GetChild(0).GetValue();
+      std::vector<size_t> inputs = reads[i];
+
+      // Find the one statement that reads this value; nothing before it may
+      // change the inputs, and nothing after it may read the value again.  A
+      // loop body may run any number of times (or never), so a loop only counts
+      // as the use if it reads the value in its set expression, and a write in
+      // a loop body does not end the value's life.
+      size_t use = num_statements;
+      bool ok = true;
+      for (size_t j = i + 1; j < num_statements && ok; ++j) {
+        ASTNode & statement = *statements[j];
+        const bool is_loop = statement.GetType() == ASTNode::FOREACH;
+        const size_t num_reads = std::count(reads[j].begin(), reads[j].end(), var_id);
+        const bool writes_var = Has(writes[j], var_id);
+        const bool overwrites = writes_var && !is_loop;
+        if (use < num_statements) {             // Already found the use.
+          if (num_reads) ok = false;
+          if (overwrites) break;
+          continue;
+        }
+        if (num_reads == 0) {
+          if (writes_var) ok = false;           // Never used; left to RemoveDeadStores().
+          if (HasType(statement, ASTNode::SAVE)) ok = false;   // May rewrite the file.
+          for (size_t var : writes[j]) if (Has(inputs, var)) ok = false;
+          continue;
+        }
+        // The read must happen before any write in the using statement.
+        const ASTNode & first_part = statement.GetType() == ASTNode::ASSIGN || is_loop
+          ? statement.GetChild(1) : statement;
+        if (num_reads != 1 || HasAssign(first_part)) ok = false;
+        if (is_loop && !FindFilterOf(statement.GetChild(1), var_id)) ok = false;
+        use = j;
+        if (overwrites) break;
+      }
+      if (!ok || use == num_statements) continue;
+      ASTNode * filter = FindFilterOf(*statements[use], var_id);
+      if (!filter) continue;
+
+      std::vector<ASTNode *> def_parts = def.TakeChildren();
+      std::vector<ASTNode *> filter_parts = filter->TakeChildren();
+      filter->AddChild(def_parts[1]);
+      filter->AddChild(filter_parts[1]);
+      deferred.push_back(&def);
+      reads[use].erase(std::find(reads[use].begin(), reads[use].end(), var_id));
+      reads[use].insert(reads[use].end(), inputs.begin(), inputs.end());
+      reads[i].clear();
+    }
+    if (deferred.empty()) return false;
+    DropStatements(*root, deferred);
+    return true;
+  }
+
+  // Drop assignments whose value is never read, and expression statements with
+  // no effect.  Statements are visited backward while tracking which variables
+  // may still be read later on.
+  void RemoveDeadStores(ASTNode & block, std::vector<bool> & live) {
+    std::vector<ASTNode *> statements = block.TakeChildren();
+    for (size_t i = statements.size(); i-- > 0; ) {
+      ASTNode & statement = *statements[i];
+      if (statement.GetType() == ASTNode::STATEMENT_BLOCK) {
+        RemoveDeadStores(statement, live);
+        continue;
+      }
+      const bool is_assign = statement.GetType() == ASTNode::ASSIGN;
+      if (is_assign && !live[statement.GetChild(0).GetValue()] && !HasAssign(statement.GetChild(1))) {
+        statements[i] = nullptr;
+        continue;
+      }
+      const bool has_effect = statement.GetType() == ASTNode::PRINT ||
+                              statement.GetType() == ASTNode::SAVE;
+      if (!is_assign && !has_effect && !HasAssign(statement)) {
+        statements[i] = nullptr;
+        continue;
+      }
+      // Loops are kept whole.  Their body may run any number of times, so what
+      // it writes may still hold an earlier value afterward.
+      std::vector<size_t> reads, writes;
+      CollectReadsWrites(statement, reads, writes);
+      if (statement.GetType() != ASTNode::FOREACH) {
+        for (size_t var_id : writes) live[var_id] = false;
+      }
+      for (size_t var_id : reads) live[var_id] = true;
+    }
+    for (ASTNode * statement : statements) if (statement) block.AddChild(statement);
+  }
+
+  // === COMMON SUBEXPRESSIONS ===
+  // Identical pure expressions (same structure, variables and literals) share a
+  // result slot, so each is computed once until a variable it reads changes.  A
+  // pure expression in a loop body that reads nothing the loop changes gets a
+  // slot of its own, so it is computed once rather than on every iteration.
+
+  struct ExprCandidate {
+    size_t hash;
+    ASTNode * node;
+    bool loop_invariant;
+  };
+
+  static size_t HashCombine(size_t seed, size_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+  }
+
+  // Hash a subtree and report whether it is pure.  Pure compound expressions are
+  // added to candidates; a filter fused into the chain above it never runs on
+  // its own, so it is not a candidate.  loop_writes lists the variables that the
+  // innermost loop around node may change (nullptr outside of loops).
+  size_t HashTree(ASTNode & node, bool & pure, std::vector<ExprCandidate> & candidates,
+                  const std::vector<size_t> * loop_writes=nullptr, bool fused=false) {
+    std::vector<size_t> body_writes;          // Changed by this node's loop body.
+    if (node.GetType() == ASTNode::FOREACH) {
+      std::vector<size_t> reads;
+      CollectReadsWrites(node, reads, body_writes);
+    }
+    size_t hash = HashCombine(node.GetType(), node.GetValue());
+    if (node.GetType() == ASTNode::LITERAL) {
+      hash = HashCombine(hash, node.GetWords().size());
+      node.GetWords().ForEachID([&hash](size_t id){ hash = HashCombine(hash, id); });
+    }
+    if (node.GetType() == ASTNode::NEEDLE) {
+      hash = HashCombine(hash, std::hash<std::string_view>{}(node.GetText()));
+    }
+    // Once a script saves files, a load may see different contents each time.
+    pure = node.GetType() != ASTNode::ASSIGN && !(has_save && node.GetType() == ASTNode::LOAD);
+    bool first = true;
+    for (ASTNode & child : node.GetChildren()) {
+      bool child_pure = true;
+      const bool child_fused = first && IsFilter(&node) && IsFilter(&child);
+      const bool in_body = node.GetType() == ASTNode::FOREACH && &child == &node.GetChild(2);
+      hash = HashCombine(hash, HashTree(child, child_pure, candidates,
+                                        in_body ? &body_writes : loop_writes, child_fused));
+      pure = pure && child_pure;
+      first = false;
+    }
+    const bool compound = node.GetType() == ASTNode::MATH_OP || (IsFilter(&node) && !fused);
+    if (pure && compound) {
+      bool invariant = loop_writes != nullptr;
+      if (invariant) {
+        std::vector<size_t> vars;
+        CollectVars(node, vars);
+        for (size_t var_id : vars) {
+          if (std::find(loop_writes->begin(), loop_writes->end(), var_id) != loop_writes->end()) {
+            invariant = false;
           }
         }
-        // If we were filtering, keep it if we DID have a match.
-        // If we were filtering OUT, keep it if we DIDN'T have a match.
-        if ((match && !filter_out) || (!match && filter_out)) {
-          out_words.insert(word);
+      }
+      candidates.push_back(ExprCandidate{hash, &node, invariant});
+    }
+    return hash;
+  }
+
+  static void CollectVars(const ASTNode & node, std::vector<size_t> & vars) {
+    if (node.GetType() == ASTNode::VARIABLE) vars.push_back(node.GetValue());
+    for (const ASTNode & child : node.GetChildren()) CollectVars(child, vars);
+  }
+
+  void FindCommonExprs() {
+    std::vector<ExprCandidate> candidates;
+    bool pure = true;
+    HashTree(*root, pure, candidates);
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const auto & a, const auto & b){ return a.hash < b.hash; });
+
+    cache_slots.clear();
+    for (size_t start = 0, end = 0; start < candidates.size(); start = end) {
+      while (end < candidates.size() && candidates[end].hash == candidates[start].hash) ++end;
+      // Equal hashes usually mean equal trees, but group by actual structure.
+      for (size_t i = start; i < end; ++i) {
+        ASTNode * node = candidates[i].node;
+        if (node->GetCacheSlot()) continue;
+        std::vector<ASTNode *> group{node};
+        bool loop_invariant = candidates[i].loop_invariant;
+        for (size_t j = i + 1; j < end; ++j) {
+          ASTNode * other = candidates[j].node;
+          if (!other->GetCacheSlot() && SameTree(*node, *other)) {
+            group.push_back(other);
+            loop_invariant = loop_invariant || candidates[j].loop_invariant;
+          }
         }
+        if (group.size() < 2 && !loop_invariant) continue;
+        std::vector<size_t> vars;
+        CollectVars(*node, vars);
+        std::sort(vars.begin(), vars.end());
+        vars.erase(std::unique(vars.begin(), vars.end()), vars.end());
+        cache_slots.push_back(std::move(vars));
+        for (ASTNode * member : group) member->SetCacheSlot(cache_slots.size());
       }
     }
+  }
+
+  // === STATEMENT SCHEDULING ===
+  // Top-level statements (with blocks flattened) can run on the thread pool at
+  // the same time, each as soon as the earlier statements it depends on are
+  // done.  A statement depends on an earlier one if either assigns a variable
+  // the other reads or assigns, or if they share a cache slot.  Statements
+  // that print run in program order, and a statement that saves a file or
+  // runs a parallel loop runs alone.  The result, output included, is the same
+  // as running them one after another.
+
+  static void CollectCacheSlots(const ASTNode & node, std::vector<size_t> & slots) {
+    if (node.GetCacheSlot()) slots.push_back(node.GetCacheSlot() - 1);
+    for (const ASTNode & child : node.GetChildren()) CollectCacheSlots(child, slots);
+  }
+
+  static bool HasParallelLoop(const ASTNode & node) {
+    if (node.GetType() == ASTNode::FOREACH && node.GetValue()) return true;
+    for (const ASTNode & child : node.GetChildren()) {
+      if (HasParallelLoop(child)) return true;
     }
+    return false;
+  }
 
-    return out_words;
+  // Is a statement worth running alongside others (rather than being cheap
+  // enough that scheduling it would cost more than it saves)?
+  static bool IsHeavy(const ASTNode & statement) {
+    return HasType(statement, ASTNode::LOAD) || HasType(statement, ASTNode::FILTER) ||
+           HasType(statement, ASTNode::FILTER_OUT) || HasType(statement, ASTNode::FOREACH);
+  }
+
+  // Fill in statements and statement_deps, or leave them empty to run the
+  // script in order (one thread, profiling, or too little to overlap).
+  void PlanStatements() {
+    statements.clear();
+    statement_deps.clear();
+    if (!parallel_statements || profiler || pool->GetNumThreads() < 2) return;
+    std::vector<ASTNode *> all;
+    ListStatements(*root, all);
+    if (std::count_if(all.begin(), all.end(), [](const ASTNode * s){ return IsHeavy(*s); }) < 2) return;
+
+    // Resources are the variables, then the cache slots, then the output.
+    constexpr size_t NONE = static_cast<size_t>(-1);
+    const size_t num_vars = symbols.GetNumVars();
+    const size_t output = num_vars + cache_slots.size();
+    std::vector<size_t> last_writer(output + 1, NONE);
+    std::vector<std::vector<size_t>> readers(output + 1);   // Since the last write.
+    size_t barrier = NONE;                                  // Last statement that ran alone.
+    std::vector<size_t> since_barrier;
+    std::vector<std::vector<size_t>> deps(all.size());
+    for (size_t i = 0; i < all.size(); ++i) {
+      std::vector<size_t> reads, writes, slots;
+      CollectReadsWrites(*all[i], reads, writes);
+      CollectCacheSlots(*all[i], slots);
+      for (size_t slot : slots) writes.push_back(num_vars + slot);
+      if (HasType(*all[i], ASTNode::PRINT)) writes.push_back(output);
+
+      if (HasType(*all[i], ASTNode::SAVE) || HasParallelLoop(*all[i])) {
+        deps[i] = std::move(since_barrier);
+        since_barrier.clear();
+        if (barrier != NONE) deps[i].push_back(barrier);
+        barrier = i;
+      }
+      else {
+        if (barrier != NONE) deps[i].push_back(barrier);
+        since_barrier.push_back(i);
+      }
+      for (size_t var : reads) {
+        if (last_writer[var] != NONE) deps[i].push_back(last_writer[var]);
+        readers[var].push_back(i);
+      }
+      for (size_t var : writes) {
+        if (last_writer[var] != NONE) deps[i].push_back(last_writer[var]);
+        deps[i].insert(deps[i].end(), readers[var].begin(), readers[var].end());
+        readers[var].clear();
+        last_writer[var] = i;
+      }
+      std::sort(deps[i].begin(), deps[i].end());
+      deps[i].erase(std::unique(deps[i].begin(), deps[i].end()), deps[i].end());
+      if (deps[i].size() && deps[i].back() == i) deps[i].pop_back();   // Reads what it writes.
+    }
+    statements = std::move(all);
+    statement_deps = std::move(deps);
+  }
+
+  // === BYTECODE COMPILER ===
+
+  using reg_t = ByteCode::reg_t;
+
+  reg_t NewTemp() {
+    program.num_registers = std::max(program.num_registers, next_temp + 1);
+    return static_cast<reg_t>(next_temp++);
+  }
+
+  void Emit(const ASTNode & node, ByteCode::OpCode op, reg_t dest, reg_t a=0, reg_t b=0, reg_t c=0) {
+    program.code.push_back(ByteCode::Instruction{op, dest, a, b, c});
+    program.lines.push_back(node.GetLine());
+  }
+
+  // Is this "x = x + y" or "x = x - y"?  Then x can be updated in place instead
+  // of being copied (as in a loop that collects words).  y must not assign.
+  static bool IsSelfUpdate(const ASTNode & assign) {
+    const ASTNode & rhs = assign.GetChild(1);
+    return rhs.GetType() == ASTNode::MATH_OP && rhs.GetNumChildren() == 2 && !rhs.GetCacheSlot() &&
+           rhs.GetChild(0).GetType() == ASTNode::VARIABLE &&
+           rhs.GetChild(0).GetValue() == assign.GetChild(0).GetValue() && !HasAssign(rhs.GetChild(1));
   }
 
-  void Run() { Run(root); }
+  // Can running this node assign to variables?  (A loop assigns its variable.)
+  static bool HasAssign(const ASTNode & node) {
+    if (node.GetType() == ASTNode::ASSIGN || node.GetType() == ASTNode::FOREACH) return true;
+    for (const ASTNode & child : node.GetChildren()) {
+      if (HasAssign(child)) return true;
+    }
+    return false;
+  }
 
-  void PrintDebug(const ASTNode & node, std::string prefix="") const {
-    std::cout << prefix;
+  static bool HasType(const ASTNode & node, ASTNode::Type type) {
+    if (node.GetType() == type) return true;
+    for (const ASTNode & child : node.GetChildren()) {
+      if (HasType(child, type)) return true;
+    }
+    return false;
+  }
 
+  // Variables are read straight from their registers.  If code that runs before
+  // the value is used may assign to variables, take a snapshot in a temporary.
+  reg_t Pin(reg_t reg, const ASTNode & later_code) {
+    if (program.IsTemp(reg) || !HasAssign(later_code)) return reg;
+    reg_t temp = NewTemp();
+    Emit(later_code, ByteCode::OpCode::COPY, temp, reg);
+    return temp;
+  }
+
+  // Compile an expression; returns the register that will hold its value.  A
+  // repeated expression first checks its cache slot and skips its code on a hit.
+  reg_t CompileExpr(const ASTNode & node) {
+    using OpCode = ByteCode::OpCode;
+    if (!node.GetCacheSlot()) return CompileNode(node);
+    const reg_t slot = static_cast<reg_t>(node.GetCacheSlot() - 1);
+    const reg_t out = NewTemp();
+    const size_t get_pc = program.code.size();
+    Emit(node, OpCode::CACHE_GET, out, slot);
+    const reg_t value = CompileNode(node);
+    Emit(node, OpCode::CACHE_PUT, 0, slot, value);
+    Emit(node, OpCode::COPY, out, value);
+    program.code[get_pc].b = static_cast<reg_t>(program.code.size());
+    return out;
+  }
+
+  reg_t CompileNode(const ASTNode & node) {
+    using OpCode = ByteCode::OpCode;
+    switch (node.GetType()) {
+    case ASTNode::ASSIGN: {
+      assert(node.GetChildren().size() == 2);
+      assert(node.GetChild(0).GetType() == ASTNode::VARIABLE);
+      const reg_t var_reg = static_cast<reg_t>(node.GetChild(0).GetValue());
+      if (IsSelfUpdate(node)) {
+        const ASTNode & op_node = node.GetChild(1);
+        const reg_t right = CompileExpr(op_node.GetChild(1));
+        Emit(op_node, op_node.GetValue() == '+' ? OpCode::UNION : OpCode::DIFFERENCE,
+             var_reg, var_reg, right);
+        return var_reg;
+      }
+      Emit(node, OpCode::COPY, var_reg, CompileExpr(node.GetChild(1)));
+      return var_reg;
+    }
+    case ASTNode::MATH_OP: {
+      if (node.GetNumChildren() > 2) {     // Flattened union.
+        std::vector<const ASTNode *> children;
+        for (const ASTNode & child : node.GetChildren()) children.push_back(&child);
+        std::vector<reg_t> operands;
+        for (size_t i = 0; i < children.size(); ++i) {
+          reg_t reg = CompileExpr(*children[i]);
+          for (size_t j = i + 1; j < children.size(); ++j) {
+            if (HasAssign(*children[j])) { reg = Pin(reg, *children[j]); break; }
+          }
+          operands.push_back(reg);
+        }
+        const reg_t out = NewTemp();
+        Emit(node, OpCode::UNION_ALL, out, static_cast<reg_t>(program.operands.size()),
+             static_cast<reg_t>(operands.size()));
+        program.operands.insert(program.operands.end(), operands.begin(), operands.end());
+        return out;
+      }
+      assert(node.GetChildren().size() == 2);
+      const reg_t left = Pin(CompileExpr(node.GetChild(0)), node.GetChild(1));
+      const reg_t right = CompileExpr(node.GetChild(1));
+      const reg_t out = NewTemp();
+      Emit(node, node.GetValue() == '+' ? OpCode::UNION : OpCode::DIFFERENCE, out, left, right);
+      return out;
+    }
+    case ASTNode::VARIABLE:
+      return static_cast<reg_t>(node.GetValue());
+    case ASTNode::LITERAL: {
+      const reg_t out = NewTemp();
+      Emit(node, OpCode::CONST, out, static_cast<reg_t>(program.constants.size()));
+      program.constants.push_back(node.GetWords());
+      return out;
+    }
+    case ASTNode::NEEDLE: {          // Only read as a set if the tree was rewritten.
+      const reg_t out = NewTemp();
+      Emit(node, OpCode::CONST, out, static_cast<reg_t>(program.constants.size()));
+      program.constants.push_back(words_t{node.GetText()});
+      return out;
+    }
+    case ASTNode::LOAD: {
+      assert(node.GetChildren().size() == 1);
+      const reg_t filenames = CompileExpr(node.GetChild(0));
+      const reg_t out = NewTemp();
+      Emit(node, OpCode::LOAD, out, filenames);
+      return out;
+    }
+    case ASTNode::FILTER:
+    case ASTNode::FILTER_OUT:
+      return CompileFilter(node, false);
+    default:
+      assert(false);  // Not an expression.
+    }
+    return 0;
+  }
+
+  // As in the tree walker, a whole chain of filters becomes one instruction:
+  // FILTER, LOAD_FILTER if the chain starts with load(...), or PRINT_FILTER to
+  // print the result without building it (then nothing is returned).
+  reg_t CompileFilter(const ASTNode & node, bool print) {
+    using OpCode = ByteCode::OpCode;
+    std::vector<const ASTNode *> chain;
+    const ASTNode * source = &node;
+    while (IsFilter(source)) {
+      chain.push_back(source);
+      source = &source->GetChild(0);
+    }
+    auto LaterCodeAssigns = [&chain](size_t pos){  // Any ASSIGN in stages after pos?
+      for (size_t i = pos; i-- > 0; ) if (HasAssign(chain[i]->GetChild(1))) return true;
+      return false;
+    };
+    const bool stream = !print && source->GetType() == ASTNode::LOAD;   // Filter files as read.
+    reg_t words = CompileExpr(stream ? source->GetChild(0) : *source);
+    if (!program.IsTemp(words) && LaterCodeAssigns(chain.size())) words = Pin(words, node);
+    std::vector<ByteCode::FilterStage> stages;
+    for (size_t i = chain.size(); i-- > 0; ) {
+      const bool filter_out = chain[i]->GetType() == ASTNode::FILTER_OUT;
+      if (IsNeedle(&chain[i]->GetChild(1))) {
+        stages.push_back({static_cast<reg_t>(program.needle_words.size()), filter_out, true});
+        program.needle_words.push_back(chain[i]->GetChild(1).GetText());
+        continue;
+      }
+      reg_t needles = CompileExpr(chain[i]->GetChild(1));
+      if (!program.IsTemp(needles) && LaterCodeAssigns(i)) needles = Pin(needles, node);
+      stages.push_back({needles, filter_out});
+    }
+    const reg_t out = print ? 0 : NewTemp();
+    const OpCode op = print ? OpCode::PRINT_FILTER : stream ? OpCode::LOAD_FILTER : OpCode::FILTER;
+    Emit(node, op, out, words, static_cast<reg_t>(program.stages.size()),
+         static_cast<reg_t>(stages.size()));
+    program.stages.insert(program.stages.end(), stages.begin(), stages.end());
+    return out;
+  }
+
+  void CompileStatement(const ASTNode & node) {
     switch (node.GetType()) {
-    case ASTNode::EMPTY:
-      std::cout << "EMPTY" << std::endl;
-      break;
     case ASTNode::STATEMENT_BLOCK:
-      std::cout << "STATEMENT_BLOCK" << std::endl;
+      for (const ASTNode & child : node.GetChildren()) CompileStatement(child);
       break;
-    case ASTNode::ASSIGN:
-      std::cout << "ASSIGN" << std::endl;
+    case ASTNode::PRINT:
+      for (const ASTNode & child : node.GetChildren()) {
+        if (stream_print && IsFilter(&child) && !child.GetCacheSlot()) CompileFilter(child, true);
+        else Emit(node, ByteCode::OpCode::PRINT, 0, CompileExpr(child));
+      }
       break;
-    case ASTNode::MATH_OP:
-      std::cout << "MATH_OP" << std::endl;
+    case ASTNode::SAVE: {
+      const reg_t words = Pin(CompileExpr(node.GetChild(0)), node.GetChild(1));
+      Emit(node, ByteCode::OpCode::SAVE, 0, words, CompileExpr(node.GetChild(1)));
       break;
-    case ASTNode::VARIABLE:
-      std::cout << "VARIABLE" << std::endl;
+    }
+    case ASTNode::FOREACH: {            // The body follows the loop instruction.
+      const reg_t var_reg = static_cast<reg_t>(node.GetChild(0).GetValue());
+      const reg_t words = CompileExpr(node.GetChild(1));
+      const size_t loop_pc = program.code.size();
+      Emit(node, node.GetValue() ? ByteCode::OpCode::PARALLEL_FOREACH : ByteCode::OpCode::FOREACH,
+           var_reg, words);
+      next_temp = temp_base;            // The loop has taken its set.
+      CompileStatement(node.GetChild(2));
+      program.code[loop_pc].b = static_cast<reg_t>(program.code.size());
       break;
+    }
+    default:
+      CompileExpr(node);  // Expression statement; value is unused.
+    }
+    // All temporaries have been consumed by the end of a statement.
+    if (node.GetType() != ASTNode::STATEMENT_BLOCK) next_temp = temp_base;
+  }
+
+  void Compile() {
+    if (compiled) return;
+    compiled = true;
+    Prepare();
+    program = ByteCode{};
+    program.num_vars = program.num_registers = next_temp = temp_base = symbols.GetNumVars();
+    program.cache_slots = cache_slots;
+    if (statements.empty()) {
+      CompileStatement(*root);
+      return;
+    }
+    // Statements that may run at the same time cannot share temporaries.
+    for (const ASTNode * statement : statements) {
+      next_temp = temp_base = program.num_registers;
+      const size_t begin = program.code.size();
+      CompileStatement(*statement);
+      program.statements.push_back({begin, program.code.size()});
+    }
+    program.statement_deps = statement_deps;
+  }
+
+  // === C++ BACKEND ===
+  // EmitCpp() writes the prepared tree as a C++ program that prints what Run()
+  // would (see NativeRuntime.hpp).  Literal sets become static sorted arrays,
+  // and a filter chain whose needles are all literals becomes a matcher
+  // specialized for that text.  Repeated expressions keep their cache slots as
+  // plain variables that assignments clear.  Statements run in order, and
+  // parallel loops are split over the pool as in the VM.
+
+  struct CppState {
+    std::ostringstream code{};                  // Body of main().
+    std::string indent{"  "};
+    std::vector<std::vector<std::string_view>> literals{};   // Sorted words, by literal ID.
+    std::vector<std::string> pipelines{};       // Stage lists of static filter chains.
+    std::vector<std::vector<size_t>> var_slots{};   // Cache slots that read each variable.
+    std::vector<bool> cached{};                 // Slots used outside parallel loops.
+    size_t num_temps = 0;
+    size_t parallel_depth = 0;                  // Cache slots are not shared with parts.
+
+    void Line(const std::string & text) { code << indent << text << '\n'; }
+    void Open(const std::string & text) { Line(text); indent += "  "; }
+    void Close(const std::string & text="}") { indent.resize(indent.size() - 2); Line(text); }
+    std::string NewTemp() { return "t" + std::to_string(num_temps++); }
+  };
+
+  static std::string CppString(std::string_view text) {
+    std::string out = "\"";
+    for (const char c : text) {
+      const auto byte = static_cast<unsigned char>(c);
+      if (c == '"' || c == '\\') { out += '\\'; out += c; }
+      else if (byte >= 32 && byte < 127) out += c;
+      else {                                  // Three octal digits never run into the next byte.
+        out += '\\';
+        out += static_cast<char>('0' + (byte >> 6));
+        out += static_cast<char>('0' + ((byte >> 3) & 7));
+        out += static_cast<char>('0' + (byte & 7));
+      }
+    }
+    return out + "\"";
+  }
+
+  std::string CppVar(size_t var_id) const { return "v" + std::to_string(var_id) + "_" + symbols.GetVarName(var_id); }
+
+  // Temporaries are read once, so their values can be moved out.
+  static std::string CppTake(const std::string & name) {
+    return name[0] == 't' ? "std::move(" + name + ")" : name;
+  }
+
+  size_t CppLiteral(CppState & state, const words_t & words) {
+    const std::vector<std::string_view> sorted = words.SortedWords();
+    for (size_t id = 0; id < state.literals.size(); ++id) if (state.literals[id] == sorted) return id;
+    state.literals.push_back(sorted);
+    return state.literals.size() - 1;
+  }
+
+  // Which cache slots are used outside parallel loops?
+  static void FindCachedSlots(const ASTNode & node, bool in_parallel, std::vector<bool> & cached) {
+    if (node.GetCacheSlot() && !in_parallel) cached[node.GetCacheSlot() - 1] = true;
+    in_parallel |= node.GetType() == ASTNode::FOREACH && node.GetValue();
+    for (const ASTNode & child : node.GetChildren()) FindCachedSlots(child, in_parallel, cached);
+  }
+
+  void CppNoteAssign(CppState & state, size_t var_id) {
+    if (state.parallel_depth) return;
+    for (size_t slot : state.var_slots[var_id]) {
+      if (state.cached[slot]) state.Line("slot" + std::to_string(slot) + "_valid = false;");
+    }
+  }
+
+  // As in Pin(): copy a variable if later code may assign to it first.
+  std::string CppPin(CppState & state, const std::string & name, const ASTNode & later_code) {
+    if (name[0] != 'v' || !HasAssign(later_code)) return name;
+    const std::string temp = state.NewTemp();
+    state.Line("WordSet " + temp + " = " + name + ";");
+    return temp;
+  }
+
+  // Emit the code for an expression; returns the C++ variable holding its value.
+  std::string EmitCppExpr(CppState & state, const ASTNode & node) {
+    if (!node.GetCacheSlot() || state.parallel_depth) return EmitCppNode(state, node);
+    const std::string slot = "slot" + std::to_string(node.GetCacheSlot() - 1);
+    const std::string out = state.NewTemp();
+    state.Line("WordSet " + out + ";");
+    state.Line("if (" + slot + "_valid) " + out + " = " + slot + ";");
+    state.Open("else {");
+    state.Line(out + " = " + CppTake(EmitCppNode(state, node)) + ";");
+    state.Line(slot + " = " + out + ";");
+    state.Line(slot + "_valid = true;");
+    state.Close();
+    return out;
+  }
+
+  std::string EmitCppNode(CppState & state, const ASTNode & node) {
+    switch (node.GetType()) {
+    case ASTNode::ASSIGN: {
+      const size_t var_id = node.GetChild(0).GetValue();
+      const std::string var = CppVar(var_id);
+      if (IsSelfUpdate(node)) {
+        const ASTNode & op_node = node.GetChild(1);
+        const std::string right = EmitCppExpr(state, op_node.GetChild(1));
+        state.Line(var + (op_node.GetValue() == '+' ? ".Insert(" : ".Remove(") + right + ");");
+      }
+      else state.Line(var + " = " + CppTake(EmitCppExpr(state, node.GetChild(1))) + ";");
+      CppNoteAssign(state, var_id);
+      return var;
+    }
+    case ASTNode::MATH_OP: {
+      const std::string out = state.NewTemp();
+      if (node.GetNumChildren() > 2) {     // Flattened union.
+        std::vector<const ASTNode *> children;
+        for (const ASTNode & child : node.GetChildren()) children.push_back(&child);
+        std::vector<std::string> operands;
+        for (size_t i = 0; i < children.size(); ++i) {
+          std::string name = EmitCppExpr(state, *children[i]);
+          for (size_t j = i + 1; j < children.size(); ++j) {
+            if (HasAssign(*children[j])) { name = CppPin(state, name, *children[j]); break; }
+          }
+          operands.push_back(name);
+        }
+        state.Line("std::vector<WordSet> " + out + "_sets;");
+        for (const std::string & name : operands) state.Line(out + "_sets.push_back(" + CppTake(name) + ");");
+        state.Line("WordSet " + out + " = UnionAll(std::move(" + out + "_sets), pool);");
+        return out;
+      }
+      const std::string left = CppPin(state, EmitCppExpr(state, node.GetChild(0)), node.GetChild(1));
+      const std::string right = EmitCppExpr(state, node.GetChild(1));
+      state.Line("WordSet " + out + " = " + CppTake(left) + ";");
+      state.Line(out + (node.GetValue() == '+' ? ".Insert(" : ".Remove(") + right + ");");
+      return out;
+    }
+    case ASTNode::VARIABLE:
+      return CppVar(node.GetValue());
     case ASTNode::LITERAL:
-      std::cout << "LITERAL: "
-        << *node.GetWords().begin()
-        << std::endl;
-      break;
-    case ASTNode::LOAD:
-      std::cout << "LOAD" << std::endl;
-      break;
-    case ASTNode::PRINT:
-      std::cout << "PRINT" << std::endl;
-      break;
+      return "lit" + std::to_string(CppLiteral(state, node.GetWords()));
+    case ASTNode::LOAD: {
+      const std::string filenames = EmitCppExpr(state, node.GetChild(0));
+      const std::string out = state.NewTemp();
+      state.Line("WordSet " + out + " = LoadWordFiles(" + filenames + ".SortedWords(), pool, &cache);");
+      return out;
+    }
     case ASTNode::FILTER:
-      std::cout << "FILTER" << std::endl;
-      break;
     case ASTNode::FILTER_OUT:
-      std::cout << "FILTER_OUT" << std::endl;
-      break;
+      return EmitCppFilter(state, node);
+    default:
+      assert(false);  // Not an expression.
+    }
+    return "";
+  }
+
+  // A whole chain of filters is one pass, as in CompileFilter().  If every
+  // stage's needles are a literal, the pass uses a matcher written for them.
+  std::string EmitCppFilter(CppState & state, const ASTNode & node) {
+    std::vector<const ASTNode *> chain;
+    const ASTNode * source = &node;
+    while (IsFilter(source)) {
+      chain.push_back(source);
+      source = &source->GetChild(0);
+    }
+    std::reverse(chain.begin(), chain.end());         // First stage first.
+    const bool stream = source->GetType() == ASTNode::LOAD;
+    const bool is_static = std::all_of(chain.begin(), chain.end(),
+                                       [](const ASTNode * stage){ return IsLiteral(&stage->GetChild(1)); });
+    auto LaterCodeAssigns = [&chain](size_t pos){
+      for (size_t i = pos; i < chain.size(); ++i) if (HasAssign(chain[i]->GetChild(1))) return true;
+      return false;
+    };
+    std::string words = EmitCppExpr(state, stream ? source->GetChild(0) : *source);
+    if (LaterCodeAssigns(0)) words = CppPin(state, words, node);
+    const std::string out = state.NewTemp();
+
+    if (!is_static) {
+      state.Line("FilterPipeline " + out + "_stages;");
+      for (size_t i = 0; i < chain.size(); ++i) {
+        std::string needles = EmitCppExpr(state, chain[i]->GetChild(1));
+        if (LaterCodeAssigns(i + 1)) needles = CppPin(state, needles, node);
+        const bool filter_out = chain[i]->GetType() == ASTNode::FILTER_OUT;
+        state.Line(out + "_stages.AddStage(" + needles + ".SortedWords(), " +
+                   (filter_out ? "true" : "false") + ");");
+      }
+      if (stream) {
+        state.Line("WordSet " + out + " = " + out + "_stages.RunOnFiles(" + words +
+                   ".SortedWords(), pool, &cache);");
+      }
+      else state.Line("WordSet " + out + " = " + out + "_stages.Run(" + words + ", pool);");
+      return out;
+    }
+
+    // A needle that contains another needle of the same stage is redundant.
+    std::string test;
+    std::string stages;
+    for (const ASTNode * stage : chain) {
+      const words_t & needle_set = stage->GetChild(1).GetWords();
+      std::vector<std::string_view> needles = needle_set.SortedWords();
+      std::vector<std::string_view> kept;
+      for (std::string_view needle : needles) {
+        const bool redundant = std::any_of(needles.begin(), needles.end(), [needle](std::string_view other){
+          return other.size() < needle.size() && needle.find(other) != std::string_view::npos;
+        });
+        if (!redundant) kept.push_back(needle);
+      }
+      const bool filter_out = stage->GetType() == ASTNode::FILTER_OUT;
+      std::string args;
+      for (std::string_view needle : kept) args += (args.empty() ? "" : ", ") + CppString(needle);
+      test += std::string(test.empty() ? "" : " && ") + (filter_out ? "!" : "") +
+              "native::HasAny<" + args + ">(word)";
+      stages += std::string(stages.empty() ? "" : ", ") + "{LITERAL_" +
+                std::to_string(CppLiteral(state, needle_set)) + ", " + (filter_out ? "true" : "false") + "}";
+    }
+    const std::string matcher = "[](std::string_view word){ return " + test + "; }";
+    if (stream) {
+      state.Line("WordSet " + out + " = native::LoadFiltered(" + words + ", pool, cache, " + matcher + ");");
+      return out;
+    }
+    state.pipelines.push_back(stages);
+    state.Line("WordSet " + out + " = native::Filter(" + words + ", pool, pipeline" +
+               std::to_string(state.pipelines.size() - 1) + ", " + matcher + ");");
+    return out;
+  }
+
+  void EmitCppStatement(CppState & state, const ASTNode & node) {
+    switch (node.GetType()) {
+    case ASTNode::STATEMENT_BLOCK:
+      state.Open("{");
+      for (const ASTNode & child : node.GetChildren()) EmitCppStatement(state, child);
+      state.Close();
+      return;
+    case ASTNode::PRINT:
+      state.Open("{");
+      for (const ASTNode & child : node.GetChildren()) {
+        state.Line("PrintWordList(out, " + EmitCppExpr(state, child) + ");");
+      }
+      state.Close();
+      return;
+    case ASTNode::SAVE: {
+      state.Open("{");
+      const std::string words = CppPin(state, EmitCppExpr(state, node.GetChild(0)), node.GetChild(1));
+      const std::string filenames = EmitCppExpr(state, node.GetChild(1));
+      state.Line("const std::string error = SaveSnapshot(" + words + ", " + filenames + ");");
+      state.Line("if (error.size()) return native::Fail(out, " + std::to_string(node.GetLine()) + ", error);");
+      state.Close();
+      return;
     }
+    case ASTNode::FOREACH: {
+      const size_t var_id = node.GetChild(0).GetValue();
+      const std::string var = CppVar(var_id);
+      state.Open("{");
+      const std::string ids = state.NewTemp();
+      state.Line("const std::vector<WordSet::id_t> " + ids + " = " +
+                 EmitCppExpr(state, node.GetChild(1)) + ".SortedIDs();");
+      if (!node.GetValue()) {
+        state.Open("for (WordSet::id_t id : " + ids + ") {");
+        state.Line(var + ".AssignID(id);");
+        CppNoteAssign(state, var_id);
+        EmitCppStatement(state, node.GetChild(2));
+        state.Close();
+      }
+      else {
+        // Each part has its own copies of the variables declared in the loop.
+        state.Open("native::ForEachPart(pool, out, " + ids +
+                   ", [&](StringWriter & out, const WordSet::id_t * begin, const WordSet::id_t * end){");
+        std::vector<size_t> reads, writes;
+        CollectReadsWrites(node, reads, writes);
+        std::sort(writes.begin(), writes.end());
+        writes.erase(std::unique(writes.begin(), writes.end()), writes.end());
+        for (size_t id : writes) state.Line("WordSet " + CppVar(id) + ";");
+        ++state.parallel_depth;
+        state.Open("for (const WordSet::id_t * id = begin; id != end; ++id) {");
+        state.Line(var + ".AssignID(*id);");
+        EmitCppStatement(state, node.GetChild(2));
+        state.Close();
+        --state.parallel_depth;
+        state.Close("});");
+      }
+      state.Close();
+      return;
+    }
+    default:
+      state.Open("{");
+      EmitCppExpr(state, node);   // Expression statement; value is unused.
+      state.Close();
+    }
+  }
+
+  // Write a C++ program that runs this script; source_name is only used in a comment.
+  void EmitCpp(std::ostream & os, const std::string & source_name) {
+    Prepare();
+    CppState state;
+    state.var_slots.resize(symbols.GetNumVars());
+    for (size_t slot = 0; slot < cache_slots.size(); ++slot) {
+      for (size_t var_id : cache_slots[slot]) state.var_slots[var_id].push_back(slot);
+    }
+    state.cached.assign(cache_slots.size(), false);
+    FindCachedSlots(*root, false, state.cached);
+    for (const ASTNode & statement : root->GetChildren()) EmitCppStatement(state, statement);
+
+    os << "// Generated by \"WordLang --emit-cpp\" from " << source_name << ".\n"
+       << "// Build with the WordLang headers on the include path (see \"make <script>.native\").\n"
+       << "#include \"NativeRuntime.hpp\"\n\n"
+       << "namespace {\n";
+    for (size_t id = 0; id < state.literals.size(); ++id) {
+      os << "  constexpr std::array<std::string_view, " << state.literals[id].size() << "> LITERAL_" << id << "{";
+      const char * separator = "";
+      for (std::string_view word : state.literals[id]) { os << separator << CppString(word); separator = ", "; }
+      os << "};\n";
+    }
+    os << "}\n\n"
+       << "int main(int argc, char * argv[]) {\n"
+       << "  ThreadPool pool(native::NumThreads(argc, argv));\n"
+       << "  spill::GetSettings().budget = native::SpillBudget(argc, argv);\n"
+       << "  LoadCache cache;\n"
+       << "  OutputWriter & out = OutputWriter::Stdout();\n";
+    for (size_t id = 0; id < state.literals.size(); ++id) {
+      os << "  const WordSet lit" << id << " = native::MakeSet(LITERAL_" << id << ");\n";
+    }
+    for (size_t id = 0; id < state.pipelines.size(); ++id) {
+      os << "  const FilterPipeline pipeline" << id << " = native::MakePipeline({" << state.pipelines[id] << "});\n";
+    }
+    for (size_t var_id = 0; var_id < symbols.GetNumVars(); ++var_id) os << "  WordSet " << CppVar(var_id) << ";\n";
+    for (size_t slot = 0; slot < cache_slots.size(); ++slot) {
+      if (!state.cached[slot]) continue;
+      os << "  WordSet slot" << slot << ";\n  bool slot" << slot << "_valid = false;\n";
+    }
+    os << "\n" << state.code.str() << "  out.Flush();\n  return 0;\n}\n";
+  }
+
+  void UseTreeWalker(bool in=true) { use_tree_walker = in; }
+  void UseOptimizer(bool in=true) { use_optimizer = in; }
+
+  void UseCSE(bool in=true) { use_cse = in; }
+  void KeepFinalValues(bool in=true) { keep_final_values = in; }
+  void StreamPrints(bool in=true) { stream_print = in; }
+  void UseParallelStatements(bool in=true) { parallel_statements = in; }
+  void CaptureOutput(StringWriter * in) { capture = in; }
+
+  // Run the simplification pass (once) unless it was turned off.
+  void Optimize() {
+    if (!use_optimizer || optimized) return;
+    root = Simplify(root);
+    if (!keep_final_values && DeferLoads()) root = Simplify(root);
+    std::vector<bool> live(symbols.GetNumVars(), keep_final_values);
+    RemoveDeadStores(*root, live);
+    optimized = true;
+  }
+
+  // Get the tree ready to run: simplify it, then find repeated expressions.
+  void Prepare() {
+    if (prepared) return;
+    Optimize();
+    if (use_cse) FindCommonExprs();
+    PlanStatements();
+    prepared = true;
+  }
+
+  // Record time, set sizes and allocations for every node or instruction run.
+  void EnableProfiler(bool keep_trace=false) { profiler = std::make_unique<Profiler>(keep_trace); }
+  void PrintProfile(std::ostream & os) const { if (profiler) profiler->PrintReport(os); }
+  bool WriteProfileTrace(const std::string & filename) const {
+    return profiler && profiler->WriteTrace(filename);
+  }
+
+  // Track the memory variables hold, and allocations per node type (or per
+  // instruction when running byte code), for PrintMemReport().
+  void EnableMemReport() {
+    mem_report = true;
+    if (!profiler) profiler = std::make_unique<Profiler>();
+  }
+
+  // Bytes held by the literal sets of a tree.
+  static size_t LiteralBytes(const ASTNode & node) {
+    size_t bytes = node.GetType() == ASTNode::LITERAL ? node.GetWords().MemoryBytes() : 0;
+    for (const ASTNode & child : node.GetChildren()) bytes += LiteralBytes(child);
+    return bytes;
+  }
+
+  // Where the memory went: call after Run().
+  void PrintMemReport(std::ostream & os) const {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    os << "=== Memory ===\n"
+       << "peak RSS: " << usage.ru_maxrss / 1024 << " MB\n"
+       << "tokens: " << tokens.GetNumTokens() << ", with " << tokens.GetLexemeBytes()
+       << " bytes of lexemes viewing " << tokens.GetSourceSize() << " bytes of script (not copied)\n"
+       << "AST: " << ast.GetNumNodes() << " nodes in " << ast.GetNumBlocks() << " blocks of "
+       << sizeof(ASTNode) << "-byte slots (" << ast.GetBytes() << " bytes), literal sets "
+       << (root ? LiteralBytes(*root) : 0) << " bytes\n"
+       << "variables (bytes held; a set shared by several variables counts for each):\n"
+       << std::setw(6) << "line" << "  " << std::left << std::setw(16) << "name" << std::right
+       << std::setw(14) << "peak bytes" << std::setw(14) << "final bytes" << '\n';
+    for (size_t var_id = 0; var_id < symbols.GetNumVars(); ++var_id) {
+      os << std::setw(6) << symbols.GetDeclareLine(var_id) << "  " << std::left << std::setw(16)
+         << symbols.GetVarName(var_id) << std::right
+         << std::setw(14) << std::max(symbols.GetPeakBytes(var_id), symbols.VarValue(var_id).MemoryBytes())
+         << std::setw(14) << symbols.VarValue(var_id).MemoryBytes() << '\n';
+    }
+    os << "allocations by " << (use_tree_walker ? "node type" : "instruction") << ":\n";
+    if (profiler) profiler->PrintAllocReport(os);
+    os << std::flush;
+  }
+
+  void PrintByteCode() {
+    Compile();
+    program.Print(std::cout);
+  }
+
+  // Printed lists go through OutputWriter::Stdout(), which is flushed at the end
+  // (or to the output of a server request).
+  void Run() {
+    std::cout.flush();
+    if (use_tree_walker) {
+      Prepare();
+      expr_cache.Reset(symbols.GetNumVars(), cache_slots);
+      if (statements.empty()) Run(*root);
+      else pool->RunGraph(statement_deps, [this](size_t i){ Run(*statements[i]); });
+      if (!capture) OutputWriter::Stdout().Flush();
+      return;
+    }
+    Compile();
+    VirtualMachine vm(*pool, load_cache.get());
+    vm.SetProfiler(profiler.get());
+    vm.CaptureOutput(capture);
+    for (size_t var_id = 0; var_id < num_globals; ++var_id) {
+      vm.SetRegister(static_cast<reg_t>(var_id), symbols.VarValue(var_id));
+    }
+    vm.Run(program);
+    if (!capture) OutputWriter::Stdout().Flush();
+    // Leave final variable values in the symbol table, as the tree walker does.
+    for (size_t var_id = 0; var_id < program.num_vars; ++var_id) {
+      symbols.VarValue(var_id) = vm.GetRegister(static_cast<reg_t>(var_id));
+      if (mem_report) symbols.NoteBytes(var_id, vm.GetPeakBytes(static_cast<reg_t>(var_id)));
+    }
+  }
+
+  // Run a server request (see the request constructor); what it prints is put in
+  // output.  Returns an error message, or "" if the request succeeded.
+  std::string RunRequest(std::string_view source, std::string & output) const {
+    StringWriter out;
+    std::string error;
+    try {
+      WordLang request(source, *this, out);
+      request.Run();
+    }
+    catch (const ScriptError & e) {
+      error = "(line " + std::to_string(e.GetLine()) + "): " + e.what();
+    }
+    catch (const std::runtime_error & e) {   // Such as running out of room to spill.
+      error = e.what();
+    }
+    output = out.TakeText();
+    return error;
+  }
+
+  // === WATCH MODE ===
+  // A watched script runs one top-level statement (blocks flattened) at a time
+  // on the tree walker, while state keeps what each one did.  A statement with
+  // the same key as one in the last run (see WatchState), whose loaded files
+  // are unchanged, gets that run's assigned values and output back instead of
+  // running.  Any other statement runs, and what it assigns gets a new version,
+  // so every later statement reading it runs too.  Statements that save() always
+  // run.  The loads that do run share state's load cache, so only changed files
+  // are read again.
+
+  // A statement's tree as text, with variables by name.
+  static void WatchKey(const ASTNode & node, const std::vector<std::string> & var_names, std::string & key) {
+    key += std::to_string(node.GetType());
+    if (node.GetType() == ASTNode::VARIABLE) key += '$' + var_names[node.GetValue()];
+    else if (node.GetType() == ASTNode::LITERAL) {
+      for (std::string_view word : node.GetWords().SortedWords()) {
+        key += ' ' + std::to_string(word.size()) + ':';
+        key += word;
+      }
+    }
+    else key += ',' + std::to_string(node.GetValue());
+    key += '(';
+    for (const ASTNode & child : node.GetChildren()) WatchKey(child, var_names, key);
+    key += ')';
+  }
+
+  static void RemoveRepeats(std::vector<size_t> & vars) {
+    std::vector<size_t> unique;
+    for (size_t var : vars) if (std::find(unique.begin(), unique.end(), var) == unique.end()) unique.push_back(var);
+    vars = std::move(unique);
+  }
+
+  struct WatchCounts {
+    size_t reused = 0;
+    size_t total = 0;
+  };
+
+  // Run the parsed script against what earlier runs kept in state, and keep
+  // this run's statements there for the next one.  Printed lists go to
+  // OutputWriter::Stdout(), in program order.
+  WatchCounts RunWatched(WatchState & state) {
+    std::cout.flush();
+    watch_state = &state;
+    load_cache = state.load_cache;
+    KeepFinalValues();                  // The next run may restore them.
+    UseCSE(false);                      // Repeats are reused by statement instead.
+    Optimize();
+    expr_cache.Reset(symbols.GetNumVars(), cache_slots);
+
+    // Variables by name, and which declaration of that name they are.
+    const size_t num_vars = symbols.GetNumVars();
+    std::vector<std::string> var_names(num_vars);
+    std::unordered_map<std::string, size_t> name_counts;
+    for (size_t var_id = 0; var_id < num_vars; ++var_id) {
+      const std::string & name = symbols.GetVarName(var_id);
+      var_names[var_id] = name + '#' + std::to_string(name_counts[name]++);
+    }
+    std::vector<uint64_t> versions(num_vars, 0);    // 0: never assigned.
+
+    std::vector<ASTNode *> all;
+    ListStatements(*root, all);
+    WatchCounts counts{0, all.size()};
+    std::unordered_map<std::string, WatchState::Entry> kept;
+    OutputWriter & out = OutputWriter::Stdout();
+    state.failed_files.clear();
+    for (ASTNode * statement : all) {
+      std::vector<size_t> reads, writes;
+      CollectReadsWrites(*statement, reads, writes);
+      // A loop body may never run, leaving what it assigns as it was.
+      if (HasType(*statement, ASTNode::FOREACH)) reads.insert(reads.end(), writes.begin(), writes.end());
+      RemoveRepeats(reads);
+      RemoveRepeats(writes);
+      std::string key;
+      WatchKey(*statement, var_names, key);
+      for (size_t var_id : reads) key += ' ' + var_names[var_id] + '=' + std::to_string(versions[var_id]);
+
+      const WatchState::Entry * last = nullptr;
+      if (auto it = kept.find(key); it != kept.end()) last = &it->second;
+      else if (auto it = state.entries.find(key); it != state.entries.end()) last = &it->second;
+      WatchState::Entry entry;
+      if (last && !HasType(*statement, ASTNode::SAVE) && !watch::Changed(last->files)) {
+        assert(last->values.size() == writes.size());
+        entry = *last;
+        for (size_t i = 0; i < writes.size(); ++i) symbols.VarValue(writes[i]) = entry.values[i];
+        ++counts.reused;
+      }
+      else {
+        entry.version = ++state.last_version;
+        StringWriter output;
+        capture = &output;
+        watch_loads = &entry.files;
+        try {
+          Run(*statement);
+        }
+        catch (...) {                   // Keep what the last run had for the rest.
+          capture = nullptr;
+          watch_loads = nullptr;
+          out.Write(output.GetText());
+          state.failed_files = std::move(entry.files);
+          for (auto & [old_key, old_entry] : state.entries) kept.try_emplace(old_key, std::move(old_entry));
+          state.entries = std::move(kept);
+          throw;
+        }
+        capture = nullptr;
+        watch_loads = nullptr;
+        entry.output = output.TakeText();
+        for (size_t var_id : writes) entry.values.push_back(symbols.VarValue(var_id));
+      }
+      for (size_t var_id : writes) versions[var_id] = entry.version;
+      out.Write(entry.output);
+      kept.insert_or_assign(std::move(key), std::move(entry));
+    }
+    out.Flush();
+    state.entries = std::move(kept);
+    return counts;
+  }
+
+  // === LIBRARY API ===
+  // For embedding the interpreter: Compile() parses and compiles a script once,
+  // and Execute() runs the result.  A compiled program is never changed by
+  // running it (each run gets a VM of its own), so any number of threads may
+  // Execute() one program at the same time.  Errors are returned, never printed.
+
+  // Values for a program's inputs, by name; inputs without one start empty.
+  using bindings_t = std::unordered_map<std::string, words_t>;
+
+  // Compile a script that may read the named inputs.  On failure, returns
+  // nullptr and sets error ("(line N): message").  Runs share pool, or a pool
+  // with one thread per hardware thread if none is given.
+  static std::shared_ptr<const WordLang> Compile(std::string_view source,
+                                                 const std::vector<std::string> & inputs,
+                                                 std::string & error,
+                                                 std::shared_ptr<ThreadPool> pool=nullptr) {
+    if (!pool) pool = std::make_shared<ThreadPool>(ThreadPool::DefaultThreads());
+    try {
+      error.clear();
+      return std::make_shared<const WordLang>(std::string(source), inputs, std::move(pool));
+    }
+    catch (const ScriptError & e) {
+      error = "(line " + std::to_string(e.GetLine()) + "): " + e.what();
+    }
+    catch (const std::runtime_error & e) {
+      error = e.what();
+    }
+    return nullptr;
+  }
+
+  // Run a compiled program; what it prints is put in output.  Returns an error
+  // message, or "" if the run succeeded.
+  std::string Execute(const bindings_t & bindings, std::string & output) const {
+    StringWriter out;
+    std::string error;
+    try {
+      VirtualMachine vm(*pool, load_cache.get());
+      vm.CaptureOutput(&out);
+      for (const auto & [name, value] : bindings) {
+        size_t var_id = 0;
+        while (var_id < num_globals && symbols.GetVarName(var_id) != name) ++var_id;
+        if (var_id == num_globals) throw std::runtime_error("Unknown input '" + name + "'.");
+        vm.SetRegister(static_cast<reg_t>(var_id), value);
+      }
+      vm.Run(program);
+    }
+    catch (const ScriptError & e) {
+      error = "(line " + std::to_string(e.GetLine()) + "): " + e.what();
+    }
+    catch (const std::runtime_error & e) {
+      error = e.what();
+    }
+    output = out.TakeText();
+    return error;
+  }
+
+  void PrintDebug(std::ostream & os, const ASTNode & node, std::string prefix="") const {
+    os << prefix << node.GetTypeName();
+    if (node.GetType() == ASTNode::NEEDLE) os << ": " << node.GetText();
+    if (node.GetType() == ASTNode::LITERAL) {
+      os << ":";
+      const char * separator = " ";
+      for (std::string_view word : node.GetWords().SortedWords()) {
+        os << separator << word;
+        separator = ", ";
+      }
+    }
+    os << std::endl;
 
     for (const auto & child : node.GetChildren()) {
-      PrintDebug(child, prefix+"  ");
+      PrintDebug(os, child, prefix+"  ");
     }
   }
 
-  void PrintDebug() const { PrintDebug(root); }
+  void PrintDebug() const {
+    if (root) PrintDebug(std::cout, *root);
+    else std::cout << cached_debug << std::flush;
+  }
+
+  // === SCRIPT CACHE ===
+  // A cached program is its byte code, its variables' names and declaring
+  // lines, and the tree as PrintDebug() shows it (see ScriptCache.hpp).
+
+  // Settings that change the compiled program, and so are part of the key.
+  uint64_t CacheSettings() const {
+    return uint64_t{use_optimizer} | uint64_t{use_cse} << 1 | uint64_t{stream_print} << 2 |
+           uint64_t{parallel_statements && pool->GetNumThreads() >= 2} << 3;
+  }
+
+  // Compile the parsed script and write it to the cache in dir.  Call before
+  // anything optimizes the tree.
+  void WriteScriptCache(const std::string & dir) {
+    const std::string_view source = tokens.GetSource();
+    script_cache::Writer out;
+    std::ostringstream debug;
+    PrintDebug(debug, *root);
+    out.PutString(debug.str());
+    out.Put<uint64_t>(symbols.GetNumVars());
+    for (size_t var_id = 0; var_id < symbols.GetNumVars(); ++var_id) {
+      out.PutString(symbols.GetVarName(var_id));
+      out.Put<uint64_t>(symbols.GetDeclareLine(var_id));
+    }
+    Compile();
+    script_cache::WriteByteCode(out, program);
+    // The directory is made if need be.  Failing to write the cache is not an
+    // error (the script just compiles again next time), but it is reported.
+    if (!script_cache::MakeDir(dir) ||
+        !script_cache::WriteFile(script_cache::FileName(dir, source, CacheSettings()),
+                                 script_cache::MakeFile(source, CacheSettings(), out))) {
+      std::cerr << "WARNING: Unable to write script cache in '" << dir << "'." << std::endl;
+    }
+  }
+
+  // Use this script's program from the cache in dir, if it is there, instead of
+  // parsing and compiling.  Returns false (changing nothing) if it is not.
+  bool ReadScriptCache(const std::string & dir) {
+    const std::string_view source = tokens.GetSource();
+    MappedFile file(script_cache::FileName(dir, source, CacheSettings()));
+    script_cache::Reader in(file.GetText());
+    if (!script_cache::CheckHeader(in, source, CacheSettings())) return false;
+    std::string debug(in.GetString());
+    std::vector<std::pair<std::string_view, size_t>> vars(std::min<uint64_t>(in.Get<uint64_t>(), 1 << 24));
+    for (auto & [name, line] : vars) {
+      name = in.GetString();
+      line = in.Get<uint64_t>();
+    }
+    ByteCode loaded;
+    if (!script_cache::ReadByteCode(in, loaded) || !in.AtEnd() || loaded.num_vars != vars.size()) return false;
+    for (const auto & [name, line] : vars) symbols.RestoreVar(name, line);
+    cached_debug = std::move(debug);
+    program = std::move(loaded);
+    prepared = compiled = true;
+    return true;
+  }
 
 };
 
 
+// Build with -DWORDLANG_LIBRARY to use the interpreter from another program
+// through WordLang::Compile() and Execute() (see README.md).
+#ifndef WORDLANG_LIBRARY
+
+// Server mode: run the script once for its variables (what it prints goes to
+// standard error), then answer requests against them on standard input and
+// output, or on a Unix socket at socket_path.
+int Serve(WordLang & globals, const std::string & socket_path) {
+  StringWriter globals_output;
+  globals.KeepFinalValues();
+  globals.CaptureOutput(&globals_output);
+  globals.Run();
+  std::cerr << globals_output.GetText();
+  auto handler = [&globals](std::string_view source, std::string & output){
+    return globals.RunRequest(source, output);
+  };
+  if (socket_path.empty()) {
+    ServeStream(STDIN_FILENO, STDOUT_FILENO, handler);
+    return 0;
+  }
+  ServeSocket(socket_path, handler);
+  std::cerr << "Unable to listen on socket '" << socket_path << "'." << std::endl;
+  return 1;
+}
+
+// Watch mode: run the script, then run it again each time it or a file it
+// loaded changes, reusing what did not change (see WordLang::RunWatched()).
+// Errors are reported and watching goes on.  configure applies the command-line
+// settings to each run's interpreter.
+[[noreturn]] void Watch(const std::string & filename, size_t num_threads,
+                        const std::function<void(WordLang &)> & configure) {
+  WatchState state;
+  while (true) {
+    const watch::FileStamp script_stamp = watch::FileStamp::Of(filename);
+    const auto start = std::chrono::steady_clock::now();
+    try {
+      WordLang lang(filename, num_threads);
+      configure(lang);
+      lang.Parse();
+      const auto counts = lang.RunWatched(state);
+      const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+      std::cerr << "OK " << std::fixed << std::setprecision(3) << time.count() << "ms ("
+                << counts.reused << " of " << counts.total << " statements reused)" << std::endl;
+    }
+    catch (const ScriptError & error) {
+      OutputWriter::Stdout().Flush();
+      std::cerr << error.Describe() << std::endl;
+    }
+    catch (const std::runtime_error & error) {
+      OutputWriter::Stdout().Flush();
+      std::cerr << "ERROR: " << error.what() << std::endl;
+    }
+    watch::WaitForChange(state.GetWatchedFiles(filename, script_stamp));
+  }
+}
+
 int main(int argc, char * argv[]) {
-  if (argc != 2) {
-    std::cerr << "Format: " << argv[0] << " {filename}" << std::endl;
+  std::string filename;
+  size_t num_threads = ThreadPool::DefaultThreads();
+  bool tree_walk = false;
+  bool print_bytecode = false;
+  bool profile = false;
+  bool optimize = true;
+  bool cse = true;
+  bool print_optimized = false;
+  bool stream_print = false;
+  bool parallel_statements = true;
+  bool emit_cpp = false;
+  bool mem_report = false;
+  std::string cache_dir;
+  std::string trace_filename;
+  bool serve = false;
+  bool watch = false;
+  std::string socket_path;
+  bool args_ok = true;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--threads" && i+1 < argc) {
+      num_threads = std::strtoul(argv[++i], nullptr, 10);
+      if (num_threads == 0) args_ok = false;
+    }
+    else if (arg == "--tree-walk") tree_walk = true;
+    else if (arg == "--print-bytecode") print_bytecode = true;
+    else if (arg == "--profile") profile = true;
+    else if (arg == "--mem-report") mem_report = true;
+    else if (arg == "--no-optimize") optimize = false;
+    else if (arg == "--no-cse") cse = false;
+    else if (arg == "--print-optimized") print_optimized = true;
+    else if (arg == "--stream-print") stream_print = true;
+    else if (arg == "--no-parallel-statements") parallel_statements = false;
+    else if (arg == "--emit-cpp") emit_cpp = true;
+    else if (arg == "--unsync-stdio") std::ios::sync_with_stdio(false);
+    else if (arg == "--serve") serve = true;
+    else if (arg == "--watch") watch = true;
+    else if (arg == "--serve-socket" && i+1 < argc) socket_path = argv[++i];
+    else if (arg == "--spill-budget" && i+1 < argc) {
+      const size_t megabytes = std::strtoul(argv[++i], nullptr, 10);
+      if (megabytes == 0) args_ok = false;
+      spill::GetSettings().budget = megabytes << 20;
+    }
+    else if (arg == "--cache-dir" && i+1 < argc) cache_dir = argv[++i];
+    else if (arg == "--profile-trace" && i+1 < argc) {
+      profile = true;
+      trace_filename = argv[++i];
+    }
+    else if (filename.empty() && arg.size() && arg[0] != '-') filename = arg;
+    else args_ok = false;
+  }
+  if (!args_ok || filename.empty()) {
+    std::cerr << "Format: " << argv[0]
+              << " [--threads N] [--tree-walk] [--no-optimize] [--no-cse] [--print-optimized]"
+              << " [--print-bytecode] [--profile] [--profile-trace FILE] [--mem-report] [--stream-print]"
+              << " [--no-parallel-statements] [--unsync-stdio] [--emit-cpp]"
+              << " [--serve | --serve-socket PATH] [--watch] [--spill-budget MB] [--cache-dir DIR]"
+              << " {filename}" << std::endl;
     exit(1);
   }
 
-  WordLang lang(argv[1]);
-  lang.PrintDebug();
-  std::cout << "-------------------------" << std::endl;
-  lang.Run();  
-}
\ No newline at end of file
+  try {
+    if (watch) {
+      Watch(filename, num_threads, [&](WordLang & lang){
+        lang.UseOptimizer(optimize);
+        lang.StreamPrints(stream_print);
+      });
+    }
+    WordLang lang(filename, num_threads);
+    lang.UseTreeWalker(tree_walk);
+    lang.UseOptimizer(optimize);
+    lang.UseCSE(cse);
+    lang.StreamPrints(stream_print);
+    lang.UseParallelStatements(parallel_statements);
+    // Only a plain run can use a cached program; everything else needs the tree.
+    const bool use_cache = cache_dir.size() && !tree_walk && !print_optimized && !print_bytecode &&
+                           !profile && !mem_report && !serve && socket_path.empty() && !emit_cpp;
+    const bool cached = use_cache && lang.ReadScriptCache(cache_dir);
+    if (!cached) lang.Parse();
+    if (serve || socket_path.size()) return Serve(lang, socket_path);
+    if (emit_cpp) {
+      lang.EmitCpp(std::cout, filename);
+      return 0;
+    }
+    if (profile) lang.EnableProfiler(trace_filename.size());
+    if (mem_report) lang.EnableMemReport();
+    lang.PrintDebug();
+    if (print_optimized) {
+      std::cout << "-------------------------" << std::endl;
+      lang.Optimize();
+      lang.PrintDebug();
+    }
+    if (print_bytecode) {
+      std::cout << "-------------------------" << std::endl;
+      lang.PrintByteCode();
+    }
+    if (use_cache && !cached) lang.WriteScriptCache(cache_dir);
+    std::cout << "-------------------------" << std::endl;
+    lang.Run();
+    if (profile) {
+      std::cout.flush();
+      lang.PrintProfile(std::cerr);
+      if (trace_filename.size() && !lang.WriteProfileTrace(trace_filename)) {
+        std::cerr << "Unable to write profile trace '" << trace_filename << "'." << std::endl;
+        exit(1);
+      }
+    }
+    if (mem_report) {
+      std::cout.flush();
+      lang.PrintMemReport(std::cerr);
+    }
+  }
+  catch (const ScriptError & error) {
+    OutputWriter::Stdout().Flush();         // Show everything printed before the error.
+    std::cerr << error.Describe() << std::endl;
+    exit(1);
+  }
+  catch (const std::runtime_error & error) {
+    OutputWriter::Stdout().Flush();
+    std::cerr << "ERROR: " << error.what() << std::endl;
+    exit(1);
+  }
+}
+
+#endif // #ifndef WORDLANG_LIBRARY
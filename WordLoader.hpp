@@ -0,0 +1,323 @@
+#ifndef WORDLANG_WORD_LOADER_HPP_INCLUDE_
+#define WORDLANG_WORD_LOADER_HPP_INCLUDE_
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Snapshot.hpp"
+#include "Spill.hpp"
+#include "ThreadPool.hpp"
+#include "WordSet.hpp"
+
+// Read-only view of a whole file.  Regular files are memory-mapped; anything
+// else (pipes, devices) is read into a buffer.  A file that cannot be opened
+// looks empty, matching what an ifstream-based reader would produce.
+class MappedFile {
+private:
+  void * map_base = nullptr;
+  size_t map_size = 0;
+  std::string buffer{};
+  std::string_view text{};
+
+public:
+  MappedFile(const std::string & filename) {
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+      map_size = static_cast<size_t>(info.st_size);
+      map_base = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map_base == MAP_FAILED) { map_base = nullptr; map_size = 0; }
+      else {
+        madvise(map_base, map_size, MADV_SEQUENTIAL);
+        text = std::string_view(static_cast<const char *>(map_base), map_size);
+      }
+    }
+    if (!map_base) {
+      char chunk[1 << 16];
+      ssize_t count;
+      while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+        buffer.append(chunk, static_cast<size_t>(count));
+      }
+      text = buffer;
+    }
+    close(fd);
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile & operator=(const MappedFile &) = delete;
+  ~MappedFile() { if (map_base) munmap(map_base, map_size); }
+
+  std::string_view GetText() const { return text; }
+};
+
+// Whitespace exactly as operator>> sees it in the "C" locale.
+constexpr bool IsWordSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Bit i is set if block[i] is whitespace, for the 64 bytes starting at block.
+inline uint64_t WhitespaceMask64(const char * block) {
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i range = _mm_set1_epi8('\r' - '\t');
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16*i));
+    // '\t'..'\r' is the unsigned range [0,4] after subtracting '\t'.
+    const __m128i shifted = _mm_sub_epi8(chars, tab);
+    const __m128i is_ctrl = _mm_cmpeq_epi8(_mm_min_epu8(shifted, range), shifted);
+    const __m128i is_space = _mm_or_si128(is_ctrl, _mm_cmpeq_epi8(chars, space));
+    const uint32_t bits = static_cast<uint32_t>(_mm_movemask_epi8(is_space));
+    mask |= static_cast<uint64_t>(bits) << (16*i);
+  }
+  return mask;
+#else
+  uint64_t mask = 0;
+  for (size_t i = 0; i < 64; ++i) {
+    mask |= static_cast<uint64_t>(IsWordSpace(block[i])) << i;
+  }
+  return mask;
+#endif
+}
+
+// Call fn(word) for each whitespace-separated word in text.  Words are views
+// into text; the scan works on 64-byte blocks and only stops at word edges.
+template <typename FN>
+void ForEachWord(std::string_view text, FN fn) {
+  const char * data = text.data();
+  const size_t size = text.size();
+  size_t pos = 0;
+  size_t word_start = 0;
+  bool in_word = false;
+
+  for (; pos + 64 <= size; pos += 64) {
+    const uint64_t word_bits = ~WhitespaceMask64(data + pos);
+    // Bits where we toggle between whitespace and word characters.
+    uint64_t edges = word_bits ^ ((word_bits << 1) | static_cast<uint64_t>(in_word));
+    while (edges) {
+      const size_t edge_pos = pos + static_cast<size_t>(std::countr_zero(edges));
+      if (in_word) fn(std::string_view(data + word_start, edge_pos - word_start));
+      else word_start = edge_pos;
+      in_word = !in_word;
+      edges &= edges - 1;
+    }
+  }
+
+  for (; pos < size; ++pos) {
+    if (IsWordSpace(data[pos]) == in_word) {
+      if (in_word) fn(std::string_view(data + word_start, pos - word_start));
+      else word_start = pos;
+      in_word = !in_word;
+    }
+  }
+  if (in_word) fn(std::string_view(data + word_start, size - word_start));
+}
+
+// Call fn(word) for each word of a file: the stored words of a snapshot (see
+// Snapshot.hpp), which need no scanning for whitespace, or else each
+// whitespace-separated word of the text.
+template <typename FN>
+void ForEachFileWord(std::string_view text, FN fn) {
+  if (IsSnapshot(text)) ForEachSnapshotWord(text, fn);
+  else ForEachWord(text, fn);
+}
+
+// Union a list of sets with a balanced merge tree; each level merges its pairs
+// in parallel.  Union is order-independent, so the result is deterministic.
+inline WordSet UnionAll(std::vector<WordSet> sets, ThreadPool & pool) {
+  if (sets.empty()) return WordSet{};
+  while (sets.size() > 1) {
+    const size_t num_pairs = sets.size() / 2;
+    pool.ParallelFor(num_pairs, [&sets](size_t i){ sets[2*i].Insert(sets[2*i+1]); });
+    for (size_t i = 0; i < num_pairs; ++i) sets[i] = std::move(sets[2*i]);
+    if (sets.size() % 2) sets[num_pairs] = std::move(sets.back());
+    sets.resize((sets.size() + 1) / 2);
+  }
+  return std::move(sets[0]);
+}
+
+// Load a file too big for the spill budget (see Spill.hpp), keeping the words
+// for which test(word) is true, without interning them all: batches of words
+// (views into the mapped file) that fit the budget are sorted into runs on
+// disk, and the runs are merged into the set, which spills if it is still over
+// the budget.  A snapshot is sorted already, so it is simply read in order.
+template <typename FN>
+WordSet LoadLargeFile(std::string_view text, FN test) {
+  SortedWordSetBuilder out;
+  if (IsSnapshot(text)) {
+    ForEachSnapshotWord(text, [&out, &test](std::string_view word){ if (test(word)) out.Add(word); });
+    return out.Build();
+  }
+  std::vector<std::shared_ptr<const SpillRun>> runs;
+  std::vector<std::string_view> batch;
+  size_t cost = 0;
+  auto sort_batch = [&batch]{
+    std::sort(batch.begin(), batch.end());
+    batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+  };
+  auto write_run = [&]{
+    sort_batch();
+    SpillWriter writer;
+    for (std::string_view word : batch) writer.Add(word);
+    runs.push_back(writer.Finish());
+    batch.clear();
+    cost = 0;
+  };
+  ForEachWord(text, [&](std::string_view word){
+    if (!test(word)) return;
+    batch.push_back(word);
+    cost += spill::WordCost(word);
+    if (spill::IsOverBudget(cost)) write_run();
+  });
+  if (runs.empty()) {                   // The matches fit in one batch.
+    sort_batch();
+    for (std::string_view word : batch) out.Add(word);
+    return out.Build();
+  }
+  if (batch.size()) write_run();
+  batch = std::vector<std::string_view>{};
+  MergeSpillRuns(runs, [&out](std::string_view word){ out.Add(word); });
+  return out.Build();
+}
+
+// Call load(), reporting a damaged snapshot by its file name.
+template <typename FN>
+auto ReportDamage(const std::string & filename, FN load) {
+  try {
+    return load();
+  }
+  catch (const snapshot::DamagedError &) {
+    throw std::runtime_error("Snapshot file '" + filename + "' is damaged.");
+  }
+}
+
+// Load one file.  Given a pool, the blocks of a snapshot are decoded in parallel.
+inline WordSet LoadWordFile(const std::string & filename, ThreadPool * pool=nullptr) {
+  return ReportDamage(filename, [&filename, pool]() -> WordSet {
+    MappedFile file(filename);
+    if (spill::IsOverBudget(file.GetText().size())) {
+      return LoadLargeFile(file.GetText(), [](std::string_view){ return true; });
+    }
+    if (pool && IsSnapshot(file.GetText())) return LoadSnapshot(file.GetText(), *pool);
+    WordSetBuilder builder;
+    StringInterner & interner = StringInterner::Get();
+    ForEachFileWord(file.GetText(), [&builder, &interner](std::string_view word){
+      builder.Add(interner.Intern(word));
+    });
+    return builder.Build();
+  });
+}
+
+// Word sets of files already loaded, so a dictionary used in several places is
+// read once.  An entry is reused only while the file has the same device, inode,
+// size and modification time; anything but a regular file is always re-read.
+class LoadCache {
+private:
+  struct Entry {
+    struct stat info;
+    WordSet words;
+  };
+
+  std::unordered_map<std::string, Entry> entries{};
+  std::mutex lock{};
+
+  static bool SameFile(const struct stat & a, const struct stat & b) {
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+  }
+
+public:
+  // The words of a file if they are cached and the file has not changed.
+  std::optional<WordSet> Find(const std::string & filename) {
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) return std::nullopt;
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(filename);
+    if (it == entries.end() || !SameFile(it->second.info, info)) return std::nullopt;
+    return it->second.words;
+  }
+
+  WordSet Load(const std::string & filename, ThreadPool * pool=nullptr) {
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+      return LoadWordFile(filename, pool);
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto it = entries.find(filename);
+      if (it != entries.end() && SameFile(it->second.info, info)) return it->second.words;
+    }
+    WordSet words = LoadWordFile(filename, pool);
+    std::lock_guard<std::mutex> guard(lock);
+    entries.insert_or_assign(filename, Entry{info, words});
+    return words;
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+  }
+};
+
+// Load several files at once: each file becomes a partial set on the pool, and
+// the partial sets are then combined with UnionAll().
+inline WordSet LoadWordFiles(const std::vector<std::string_view> & filenames,
+                             ThreadPool & pool, LoadCache * cache=nullptr) {
+  std::vector<WordSet> partials(filenames.size());
+  pool.ParallelFor(filenames.size(), [&filenames, &partials, &pool, cache](size_t i){
+    const std::string filename(filenames[i]);
+    partials[i] = cache ? cache->Load(filename, &pool) : LoadWordFile(filename, &pool);
+  });
+  return UnionAll(std::move(partials), pool);
+}
+
+// Like LoadWordFiles(), but keep only the words for which test(word) is true.
+// Words are tested as they are read, so rejected words are never interned and
+// the unfiltered sets are never built.  Files already in the cache are filtered
+// from their cached sets instead.
+template <typename FN>
+WordSet LoadWordFilesIf(const std::vector<std::string_view> & filenames, ThreadPool & pool,
+                        LoadCache * cache, FN test) {
+  std::vector<WordSet> partials(filenames.size());
+  pool.ParallelFor(filenames.size(), [&filenames, &partials, cache, &test](size_t i){
+    const std::string filename(filenames[i]);
+    if (cache) {
+      if (std::optional<WordSet> cached = cache->Find(filename)) {
+        partials[i] = cached->Select(test);
+        return;
+      }
+    }
+    partials[i] = ReportDamage(filename, [&filename, &test]() -> WordSet {
+      MappedFile file(filename);
+      if (spill::IsOverBudget(file.GetText().size())) return LoadLargeFile(file.GetText(), test);
+      WordSetBuilder builder;
+      StringInterner & interner = StringInterner::Get();
+      ForEachFileWord(file.GetText(), [&builder, &interner, &test](std::string_view word){
+        if (test(word)) builder.Add(interner.Intern(word));
+      });
+      return builder.Build();
+    });
+  });
+  return UnionAll(std::move(partials), pool);
+}
+
+#endif // #ifndef WORDLANG_WORD_LOADER_HPP_INCLUDE_
@@ -0,0 +1,755 @@
+#ifndef WORDLANG_WORD_SET_HPP_INCLUDE_
+#define WORDLANG_WORD_SET_HPP_INCLUDE_
+
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Spill.hpp"
+#include "ThreadPool.hpp"
+
+// Global table that assigns each distinct word a 32-bit ID.  Word text is stored
+// once in a block arena, so views returned by GetWord() stay valid forever.
+//
+// Interning is thread-safe: words are spread over independently locked shards,
+// and the ID -> word table is a paged array that readers access without locks.
+class StringInterner {
+public:
+  using id_t = uint32_t;
+
+private:
+  static constexpr size_t BLOCK_SIZE = 1 << 16;
+  static constexpr size_t NUM_SHARDS = 64;
+  static constexpr size_t PAGE_BITS = 16;
+  static constexpr size_t PAGE_SIZE = size_t{1} << PAGE_BITS;
+  static constexpr size_t NUM_PAGES = size_t{1} << (32 - PAGE_BITS);
+
+  // Open-addressing slot: low 32 bits of the word's hash plus its ID.
+  struct Slot {
+    uint32_t hash = 0;
+    id_t id = NO_ID;
+  };
+
+  struct Shard {
+    std::mutex lock{};
+    std::vector<Slot> slots = std::vector<Slot>(64);   // Word text -> ID
+    size_t num_used = 0;
+    std::vector<std::unique_ptr<char[]>> blocks{};
+    char * cur_block = nullptr;                // Block currently being filled.
+    size_t block_used = BLOCK_SIZE;            // Bytes used in cur_block.
+
+    std::string_view Store(std::string_view word) {
+      char * pos = nullptr;
+      if (word.size() > BLOCK_SIZE / 4) {      // Big words get their own block.
+        blocks.push_back(std::make_unique<char[]>(word.size()));
+        pos = blocks.back().get();
+      } else {
+        if (block_used + word.size() > BLOCK_SIZE) {
+          blocks.push_back(std::make_unique<char[]>(BLOCK_SIZE));
+          cur_block = blocks.back().get();
+          block_used = 0;
+        }
+        pos = cur_block + block_used;
+        block_used += word.size();
+      }
+      std::copy(word.begin(), word.end(), pos);
+      return std::string_view(pos, word.size());
+    }
+  };
+
+  std::array<Shard, NUM_SHARDS> shards;
+  std::unique_ptr<std::atomic<std::string_view *>[]> pages;  // ID -> word text
+  std::atomic<size_t> num_ids{0};
+
+  static uint64_t Hash(std::string_view word) {
+    return std::hash<std::string_view>{}(word) * 0x9E3779B97F4A7C15ull;
+  }
+
+  // Double a shard's table once it is half full.
+  static void Grow(Shard & shard) {
+    std::vector<Slot> old_slots(shard.slots.size() * 2);
+    std::swap(old_slots, shard.slots);
+    const size_t mask = shard.slots.size() - 1;
+    for (const Slot & slot : old_slots) {
+      if (slot.id == NO_ID) continue;
+      size_t pos = slot.hash & mask;
+      while (shard.slots[pos].id != NO_ID) pos = (pos + 1) & mask;
+      shard.slots[pos] = slot;
+    }
+  }
+
+  std::string_view * GetPage(size_t page_id) {
+    std::string_view * page = pages[page_id].load(std::memory_order_acquire);
+    if (page) return page;
+    auto fresh = std::make_unique<std::string_view[]>(PAGE_SIZE);
+    if (pages[page_id].compare_exchange_strong(page, fresh.get(), std::memory_order_acq_rel)) {
+      return fresh.release();
+    }
+    return page;                                // Another thread beat us to it.
+  }
+
+  StringInterner() : pages(std::make_unique<std::atomic<std::string_view *>[]>(NUM_PAGES)) { }
+
+public:
+  static constexpr id_t NO_ID = static_cast<id_t>(-1);
+
+  StringInterner(const StringInterner &) = delete;
+  StringInterner & operator=(const StringInterner &) = delete;
+  ~StringInterner() {
+    for (size_t i = 0; i < NUM_PAGES; ++i) delete [] pages[i].load();
+  }
+
+  static StringInterner & Get() {
+    static StringInterner interner;
+    return interner;
+  }
+
+  // Number of IDs handed out so far; all IDs are below this value.
+  size_t GetSize() const { return num_ids.load(std::memory_order_acquire); }
+
+  id_t Intern(std::string_view word) {
+    const uint64_t hash = Hash(word);
+    Shard & shard = shards[hash >> 58];        // Top 6 bits pick one of 64 shards.
+    const uint32_t short_hash = static_cast<uint32_t>(hash);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    const size_t mask = shard.slots.size() - 1;
+    size_t pos = short_hash & mask;
+    for (; shard.slots[pos].id != NO_ID; pos = (pos + 1) & mask) {
+      const Slot & slot = shard.slots[pos];
+      if (slot.hash == short_hash && GetWord(slot.id) == word) return slot.id;
+    }
+
+    const size_t id = num_ids.fetch_add(1, std::memory_order_acq_rel);
+    assert(id < NO_ID);
+    GetPage(id >> PAGE_BITS)[id & (PAGE_SIZE - 1)] = shard.Store(word);
+    shard.slots[pos] = Slot{short_hash, static_cast<id_t>(id)};
+    if (++shard.num_used * 2 > shard.slots.size()) Grow(shard);
+    return static_cast<id_t>(id);
+  }
+
+  std::string_view GetWord(id_t id) const {
+    assert(id < GetSize() && id != NO_ID);
+    return pages[id >> PAGE_BITS].load(std::memory_order_acquire)[id & (PAGE_SIZE - 1)];
+  }
+};
+
+class SubstringIndex;
+class PackedWords;
+
+// A set of interned words, kept in one of three forms picked from its size:
+//   * up to SMALL_IDS members sit inline in the handle (literals, loop
+//     variables and most per-word temporaries never touch the heap);
+//   * larger sets are sorted vectors of IDs;
+//   * once a set covers a large fraction of the interner it switches to a
+//     bitmap, so union and difference become word-wide bitwise operations and
+//     a single member is added or removed in constant time.
+// Every form visits its members in ID order; word order is only worked out
+// when a set is printed (see SortedWords()).
+//
+// Past the spill budget, a set built from words not yet in memory (a big file,
+// or an operation on a set that is spilled already) becomes a SpillRun on disk
+// instead: its words are never interned, and union, difference, Select() and
+// printing merge or scan the run in word order.  Anything that needs IDs from
+// a spilled set interns its words as they are visited.
+//
+// WordSet is a cheap handle: copies share one immutable, reference-counted body,
+// and the mutating members below clone that body first if anyone else holds it.
+class WordSet {
+public:
+  using id_t = StringInterner::id_t;
+
+private:
+  friend class SubstringIndex;
+  friend class PackedWords;
+  friend class SortedWordSetBuilder;
+
+  // A substring index built for one body (see SubstringIndex.hpp), or a packed
+  // copy of its words.  They describe exactly that body's contents, so a copy
+  // starts out without them.
+  struct IndexSlot {
+    std::mutex lock{};
+    size_t num_filters = 0;         // Filter passes over this body so far.
+    bool tried = false;             // Has building the index been attempted?
+    std::shared_ptr<const SubstringIndex> index{};
+    size_t num_scans = 0;           // Filter passes that scanned this body...
+    std::shared_ptr<const PackedWords> packed{};   // ...and its packed words (see PackedWords.hpp).
+
+    IndexSlot() = default;
+    IndexSlot(const IndexSlot &) { }
+    IndexSlot & operator=(const IndexSlot &) = delete;
+
+    void Reset() {
+      num_filters = num_scans = 0;
+      tried = false;
+      index.reset();
+      packed.reset();
+    }
+  };
+
+  struct Data {
+    std::vector<id_t> ids{};        // Sorted, unique IDs (sparse form)
+    std::vector<uint64_t> bits{};   // One bit per ID (dense form)
+    size_t count{0};
+    bool dense{false};
+    bool edited{false};             // Updated a few IDs at a time, in place?
+    std::shared_ptr<const SpillRun> run{};  // Words on disk instead (spilled form)
+    mutable IndexSlot index_slot{};
+
+    bool HasBit(id_t id) const {
+      const size_t block = id >> 6;
+      return block < bits.size() && (bits[block] >> (id & 63)) & 1;
+    }
+
+    void SetBit(id_t id) { bits[id >> 6] |= uint64_t{1} << (id & 63); }
+    void ClearBit(id_t id) {
+      if ((id >> 6) < bits.size()) bits[id >> 6] &= ~(uint64_t{1} << (id & 63));
+    }
+
+    template <typename FN>
+    void ForEachID(FN fn) const {
+      if (!dense) {
+        for (id_t id : ids) fn(id);
+        return;
+      }
+      for (size_t block_id = 0; block_id < bits.size(); ++block_id) {
+        uint64_t block = bits[block_id];
+        while (block) {
+          fn(static_cast<id_t>(block_id * 64 + static_cast<size_t>(std::countr_zero(block))));
+          block &= block - 1;
+        }
+      }
+    }
+
+    void MakeDense() {
+      if (dense) return;
+      bits.assign(NumBitWords(), 0);
+      for (id_t id : ids) SetBit(id);
+      ids = std::vector<id_t>{};
+      dense = true;
+    }
+
+    void MakeSparse() {
+      if (!dense) return;
+      ids.clear();
+      ids.reserve(count);
+      ForEachID([this](id_t id){ ids.push_back(id); });
+      bits = std::vector<uint64_t>{};
+      dense = false;
+    }
+
+    void RecountBits() {
+      count = 0;
+      for (uint64_t block : bits) count += static_cast<size_t>(std::popcount(block));
+    }
+
+    // Pick the cheaper representation for the current contents.
+    void Normalize() {
+      if (ShouldBeDense(count, StringInterner::Get().GetSize(), edited)) MakeDense();
+      else MakeSparse();
+    }
+  };
+
+  static constexpr size_t SMALL_IDS = 8;  // Most members held inline.
+  static constexpr size_t FEW_IDS = 16;   // Inserted or removed one at a time, in place.
+
+  std::shared_ptr<const Data> data{};     // nullptr for inline sets (and the empty set).
+  std::array<id_t, SMALL_IDS> small{};    // Sorted members of an inline set.
+  size_t num_small = 0;
+
+  // Bitmap is cheaper than 32-bit IDs once more than 1/32 of IDs are present.
+  // A body edited in place stays a bitmap down to 1/256: each edit of a
+  // sorted vector shifts everything after it, but a bitmap only flips a bit.
+  static bool ShouldBeDense(size_t count, size_t universe, bool edited) {
+    if (edited && count > 1024 && count * 256 > universe) return true;
+    return count > 64 && count * 32 > universe;
+  }
+
+  static size_t NumBitWords() {
+    return (StringInterner::Get().GetSize() + 63) / 64;
+  }
+
+  explicit WordSet(std::shared_ptr<Data> in) {
+    if (in && in->count) data = std::move(in);
+    Settle();
+  }
+
+  bool IsDense() const { return data && data->dense; }
+
+  static WordSet FromRun(std::shared_ptr<const SpillRun> run) {
+    auto body = std::make_shared<Data>();
+    body->count = run->GetNumWords();
+    body->run = std::move(run);
+    return WordSet(std::move(body));
+  }
+
+  static WordSet MergeSpilled(const WordSet & left, const WordSet & right, bool keep_right);
+
+  // Sorted members of a set that is not dense.
+  std::span<const id_t> IDs() const {
+    if (!data) return std::span<const id_t>(small.data(), num_small);
+    assert(!data->dense);
+    return data->ids;
+  }
+
+  void AssignSmall(std::span<const id_t> ids) {
+    assert(ids.size() <= SMALL_IDS);
+    std::copy(ids.begin(), ids.end(), small.begin());   // ids may be in data; copy first.
+    num_small = ids.size();
+    data.reset();
+  }
+
+  // Copy-on-write access to the body; clones it if it is shared.
+  Data & MutableData() {
+    if (!data) {
+      auto body = std::make_shared<Data>();
+      const std::span<const id_t> ids = IDs();
+      body->ids.assign(ids.begin(), ids.end());
+      body->count = num_small;
+      num_small = 0;
+      data = std::move(body);
+    }
+    else if (data.use_count() > 1) data = std::make_shared<Data>(*data);
+    else data->index_slot.Reset();            // Updated in place; any index is stale.
+    return const_cast<Data &>(*data);
+  }
+
+  // Move a body that has shrunk to a few sparse members back inline.
+  void Settle() {
+    if (data && !data->dense && !data->run && data->count <= SMALL_IDS) AssignSmall(data->ids);
+  }
+
+  // Replace the contents with sorted, unique IDs.
+  void AssignIDs(std::vector<id_t> ids) {
+    if (ids.size() <= SMALL_IDS) { AssignSmall(ids); return; }
+    auto body = std::make_shared<Data>();
+    body->ids = std::move(ids);
+    body->count = body->ids.size();
+    body->Normalize();
+    *this = WordSet(std::move(body));
+  }
+
+public:
+  WordSet() = default;
+  explicit WordSet(std::string_view word) : num_small(1) {
+    small[0] = StringInterner::Get().Intern(word);
+  }
+  // Build from IDs in any order, possibly with duplicates.
+  explicit WordSet(std::vector<id_t> ids) {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    AssignIDs(std::move(ids));
+  }
+  WordSet(const WordSet &) = default;
+  WordSet(WordSet &&) = default;
+  WordSet & operator=(const WordSet &) = default;
+  WordSet & operator=(WordSet &&) = default;
+
+  size_t size() const { return data ? data->count : num_small; }
+  bool empty() const { return size() == 0; }
+
+  // Do these two handles share the same body?  (Cheap identity test, not
+  // equality; inline sets count as the same only when both are empty.)
+  bool IsSameAs(const WordSet & in) const {
+    return data == in.data && (data || (num_small == 0 && in.num_small == 0));
+  }
+
+  // Do these sets have exactly the same members?
+  bool operator==(const WordSet & in) const {
+    if (IsSameAs(in)) return true;
+    if (size() != in.size()) return false;
+    bool same = true;
+    ForEachID([&in, &same](id_t id){ same = same && in.Has(id); });
+    return same;
+  }
+
+  bool Has(id_t id) const {
+    if (!data) {
+      const std::span<const id_t> ids = IDs();
+      return std::find(ids.begin(), ids.end(), id) != ids.end();
+    }
+    if (data->dense) return data->HasBit(id);
+    if (data->run) return data->run->Contains(StringInterner::Get().GetWord(id));
+    return std::binary_search(data->ids.begin(), data->ids.end(), id);
+  }
+
+  bool IsSpilled() const { return data && data->run; }
+  const SpillRun * GetSpillRun() const { return IsSpilled() ? data->run.get() : nullptr; }
+
+  // Bytes of memory held for the members (0 when they are inline or on disk).
+  // A body shared by several sets counts in full for each of them.
+  size_t MemoryBytes() const {
+    if (!data) return 0;
+    return sizeof(Data) + data->ids.capacity() * sizeof(id_t) + data->bits.capacity() * sizeof(uint64_t);
+  }
+
+  // Call fn(id) for every member, in increasing ID order (in word order for a
+  // spilled set).
+  template <typename FN>
+  void ForEachID(FN fn) const {
+    if (IsSpilled()) {
+      StringInterner & interner = StringInterner::Get();
+      for (snapshot::Cursor cursor = data->run->GetCursor(); cursor.Next(); ) fn(interner.Intern(cursor.Word()));
+    }
+    else if (data) data->ForEachID(fn);
+    else for (size_t i = 0; i < num_small; ++i) fn(small[i]);
+  }
+
+  // Call fn(word) for every member, in increasing ID order.
+  template <typename FN>
+  void ForEachWord(FN fn) const {
+    const StringInterner & interner = StringInterner::Get();
+    ForEachID([&interner, &fn](id_t id){ fn(interner.GetWord(id)); });
+  }
+
+  // Return the members for which test(word) is true.
+  template <typename FN>
+  WordSet Select(FN test) const {
+    if (IsSpilled()) return SelectSpilled(test);
+    const StringInterner & interner = StringInterner::Get();
+    if (!data) {
+      WordSet out;
+      for (id_t id : IDs()) if (test(interner.GetWord(id))) out.small[out.num_small++] = id;
+      return out;
+    }
+    auto out = std::make_shared<Data>();
+    out->ids.reserve(data->count);
+    ForEachID([&](id_t id){ if (test(interner.GetWord(id))) out->ids.push_back(id); });
+    out->count = out->ids.size();
+    out->Normalize();
+    return WordSet(std::move(out));
+  }
+
+  template <typename FN>
+  WordSet SelectSpilled(FN test) const;
+
+  // Parallel Select(): the set is cut into fixed-size chunks of IDs that the
+  // pool's threads work through (stealing from each other as they finish).  Each
+  // chunk fills its own output, and the outputs are joined in chunk order, so
+  // the result comes out sorted without any shared lock.
+  template <typename FN>
+  WordSet Select(FN test, ThreadPool & pool) const {
+    constexpr size_t CHUNK_IDS = 4096;        // Multiple of 64 for bitmap chunks.
+    if (!data || IsSpilled() || data->count < 4 * CHUNK_IDS || pool.GetNumThreads() == 1) {
+      return Select(test);
+    }
+    const Data & body = *data;
+    const size_t span = body.dense ? body.bits.size() * 64 : body.ids.size();
+    const size_t num_chunks = (span + CHUNK_IDS - 1) / CHUNK_IDS;
+    std::vector<std::vector<id_t>> results(num_chunks);
+    const StringInterner & interner = StringInterner::Get();
+    pool.ParallelFor(num_chunks, [&](size_t chunk){
+      std::vector<id_t> & out = results[chunk];
+      const size_t begin = chunk * CHUNK_IDS;
+      const size_t end = std::min(span, begin + CHUNK_IDS);
+      if (!body.dense) {
+        for (size_t i = begin; i < end; ++i) {
+          if (test(interner.GetWord(body.ids[i]))) out.push_back(body.ids[i]);
+        }
+        return;
+      }
+      for (size_t block_id = begin / 64; block_id < end / 64 + (end % 64 != 0); ++block_id) {
+        for (uint64_t block = body.bits[block_id]; block; block &= block - 1) {
+          const auto id = static_cast<id_t>(block_id * 64 + static_cast<size_t>(std::countr_zero(block)));
+          if (test(interner.GetWord(id))) out.push_back(id);
+        }
+      }
+    });
+
+    size_t total = 0;
+    for (const auto & part : results) total += part.size();
+    std::vector<id_t> ids;
+    ids.reserve(total);
+    for (const auto & part : results) ids.insert(ids.end(), part.begin(), part.end());
+    WordSet out;
+    out.AssignIDs(std::move(ids));
+    return out;
+  }
+
+  // Member IDs, in lexicographic order of their words.
+  std::vector<id_t> SortedIDs() const {
+    std::vector<std::pair<std::string_view, id_t>> entries;
+    entries.reserve(size());
+    const StringInterner & interner = StringInterner::Get();
+    ForEachID([&entries, &interner](id_t id){ entries.emplace_back(interner.GetWord(id), id); });
+    std::sort(entries.begin(), entries.end());
+    std::vector<id_t> out;
+    out.reserve(entries.size());
+    for (const auto & entry : entries) out.push_back(entry.second);
+    return out;
+  }
+
+  // Members as text, in lexicographic order (the only place IDs become strings).
+  std::vector<std::string_view> SortedWords() const {
+    std::vector<std::string_view> out;
+    out.reserve(size());
+    ForEachWord([&out](std::string_view word){ out.push_back(word); });
+    std::sort(out.begin(), out.end());
+    return out;
+  }
+
+  // Call fn(word) for every member, in lexicographic order.  A spilled set is
+  // read straight from disk, so each view is only valid during its call.
+  template <typename FN>
+  void ForEachSortedWord(FN fn) const {
+    if (!IsSpilled()) {
+      for (std::string_view word : SortedWords()) fn(word);
+      return;
+    }
+    for (snapshot::Cursor cursor = data->run->GetCursor(); cursor.Next(); ) fn(cursor.Word());
+  }
+
+  // Become the one-word set {id}; it is held inline, so rebinding a loop
+  // variable allocates nothing.
+  void AssignID(id_t id) {
+    data.reset();
+    small[0] = id;
+    num_small = 1;
+  }
+
+  // Add every member of in to this set.
+  void Insert(const WordSet & in) {
+    if (in.empty() || IsSameAs(in)) return;
+    if (empty()) { *this = in; return; }
+    if (IsSpilled() || in.IsSpilled()) { *this = MergeSpilled(*this, in, true); return; }
+    if (!IsDense() && !in.IsDense()) {
+      const std::span<const id_t> mine = IDs();
+      const std::span<const id_t> other = in.IDs();
+      if (!data && !in.data) {             // Both inline; merge on the stack.
+        std::array<id_t, 2 * SMALL_IDS> merged;
+        const auto end = std::set_union(mine.begin(), mine.end(), other.begin(), other.end(), merged.begin());
+        const size_t count = static_cast<size_t>(end - merged.begin());
+        if (count <= SMALL_IDS) AssignSmall(std::span<const id_t>(merged.data(), count));
+        else AssignIDs(std::vector<id_t>(merged.begin(), end));
+        return;
+      }
+      // A few words added to a body nobody else holds go straight into it, so
+      // growing a set one word at a time does not rebuild it every time.
+      if (data && data.use_count() == 1 && other.size() <= FEW_IDS) {
+        Data & body = MutableData();
+        for (id_t id : other) {
+          auto pos = std::lower_bound(body.ids.begin(), body.ids.end(), id);
+          if (pos == body.ids.end() || *pos != id) body.ids.insert(pos, id);
+        }
+        body.count = body.ids.size();
+        body.edited = true;
+        body.Normalize();
+        return;
+      }
+      std::vector<id_t> merged(mine.size() + other.size());
+      auto end = std::set_union(mine.begin(), mine.end(), other.begin(), other.end(), merged.begin());
+      merged.erase(end, merged.end());
+      AssignIDs(std::move(merged));
+      return;
+    }
+    if (!IsDense()) {                  // Only the other side is dense; start from it.
+      WordSet few = *this;
+      *this = in;
+      Insert(few);
+      return;
+    }
+    Data & body = MutableData();
+    body.bits.resize(NumBitWords(), 0);
+    if (in.IsDense()) {
+      const Data & other = *in.data;
+      for (size_t i = 0; i < other.bits.size(); ++i) body.bits[i] |= other.bits[i];
+      body.RecountBits();
+    } else {
+      for (id_t id : in.IDs()) {
+        if (!body.HasBit(id)) { body.SetBit(id); ++body.count; }
+      }
+      if (in.size() <= FEW_IDS) body.edited = true;
+    }
+  }
+
+  // Remove every member of in from this set.
+  void Remove(const WordSet & in) {
+    if (empty() || in.empty()) return;
+    if (IsSameAs(in)) { *this = WordSet{}; return; }
+    if (IsSpilled() || in.IsSpilled()) { *this = MergeSpilled(*this, in, false); return; }
+    if (!data) {                       // Inline; drop members where they are.
+      size_t kept = 0;
+      for (size_t i = 0; i < num_small; ++i) {
+        if (!in.Has(small[i])) small[kept++] = small[i];
+      }
+      num_small = kept;
+      return;
+    }
+    if (!data->dense) {
+      // Likewise, a few words are taken out of an unshared body in place.
+      if (data.use_count() == 1 && !in.IsDense() && in.size() <= FEW_IDS) {
+        Data & body = MutableData();
+        for (id_t id : in.IDs()) {
+          auto pos = std::lower_bound(body.ids.begin(), body.ids.end(), id);
+          if (pos != body.ids.end() && *pos == id) body.ids.erase(pos);
+        }
+        body.count = body.ids.size();
+        body.edited = true;
+        body.Normalize();
+        Settle();
+        return;
+      }
+      std::vector<id_t> kept;
+      kept.reserve(data->count);
+      if (in.IsDense()) {
+        for (id_t id : data->ids) if (!in.data->HasBit(id)) kept.push_back(id);
+      } else {
+        const std::span<const id_t> other = in.IDs();
+        kept.resize(data->count);
+        auto end = std::set_difference(data->ids.begin(), data->ids.end(),
+                                       other.begin(), other.end(), kept.begin());
+        kept.erase(end, kept.end());
+      }
+      AssignIDs(std::move(kept));
+      return;
+    }
+    Data & body = MutableData();
+    if (in.IsDense()) {
+      const Data & other = *in.data;
+      const size_t shared = std::min(body.bits.size(), other.bits.size());
+      for (size_t i = 0; i < shared; ++i) body.bits[i] &= ~other.bits[i];
+      body.RecountBits();
+    } else {
+      for (id_t id : in.IDs()) {
+        if (body.HasBit(id)) { body.ClearBit(id); --body.count; }
+      }
+      if (in.size() <= FEW_IDS) body.edited = true;
+    }
+    body.Normalize();
+    Settle();
+  }
+
+  WordSet Union(const WordSet & in) const {
+    WordSet out = *this;
+    out.Insert(in);
+    return out;
+  }
+
+  WordSet Difference(const WordSet & in) const {
+    WordSet out = *this;
+    out.Remove(in);
+    return out;
+  }
+};
+
+// Accumulates IDs (with repeats) and produces a WordSet.  A seen-bitmap drops
+// duplicates as they arrive, so repetitive input costs no extra memory.
+class WordSetBuilder {
+private:
+  using id_t = WordSet::id_t;
+  std::vector<id_t> ids{};
+  std::vector<uint64_t> seen{};
+
+public:
+  void Add(id_t id) {
+    const size_t block = id >> 6;
+    if (block >= seen.size()) seen.resize(std::max(block + 1, seen.size() * 2), 0);
+    const uint64_t bit = uint64_t{1} << (id & 63);
+    if (seen[block] & bit) return;
+    seen[block] |= bit;
+    ids.push_back(id);
+  }
+
+  void Add(std::string_view word) { Add(StringInterner::Get().Intern(word)); }
+
+  WordSet Build() {
+    seen = std::vector<uint64_t>{};
+    return WordSet{std::move(ids)};
+  }
+};
+
+// Builds a set from words given in increasing order without repeats (say, the
+// output of a merge).  Words are held as text until they pass the spill budget;
+// from then on they go to a SpillRun, and the set comes out spilled.
+class SortedWordSetBuilder {
+private:
+  std::string text{};
+  std::vector<size_t> ends{};             // Where each word in text ends.
+  size_t cost = 0;
+  std::unique_ptr<SpillWriter> writer{};
+
+public:
+  void Add(std::string_view word) {
+    if (writer) { writer->Add(word); return; }
+    text.append(word);
+    ends.push_back(text.size());
+    cost += spill::WordCost(word);
+    if (!spill::IsOverBudget(cost)) return;
+    writer = std::make_unique<SpillWriter>();
+    for (size_t i = 0, start = 0; i < ends.size(); start = ends[i++]) {
+      writer->Add(std::string_view(text).substr(start, ends[i] - start));
+    }
+    text = std::string{};
+    ends = std::vector<size_t>{};
+  }
+
+  WordSet Build() {
+    if (writer) return WordSet::FromRun(writer->Finish());
+    std::vector<WordSet::id_t> ids;
+    ids.reserve(ends.size());
+    StringInterner & interner = StringInterner::Get();
+    for (size_t i = 0, start = 0; i < ends.size(); start = ends[i++]) {
+      ids.push_back(interner.Intern(std::string_view(text).substr(start, ends[i] - start)));
+    }
+    return WordSet{std::move(ids)};
+  }
+};
+
+template <typename FN>
+WordSet WordSet::SelectSpilled(FN test) const {
+  SortedWordSetBuilder out;
+  ForEachSortedWord([&out, &test](std::string_view word){ if (test(word)) out.Add(word); });
+  return out.Build();
+}
+
+// Union (keep_right) or difference of two sets, one of them spilled, as one
+// pass over both in word order.
+inline WordSet WordSet::MergeSpilled(const WordSet & left, const WordSet & right, bool keep_right) {
+  // Steps through a set's words in order: a spilled set from disk, any other
+  // from SortedWords().
+  struct Cursor {
+    std::optional<snapshot::Cursor> run{};
+    std::vector<std::string_view> words{};
+    size_t next = 0;
+    std::string_view word{};
+    bool valid = false;
+
+    explicit Cursor(const WordSet & set) {
+      if (set.IsSpilled()) run.emplace(set.data->run->GetCursor());
+      else words = set.SortedWords();
+      Next();
+    }
+    void Next() {
+      if (run) {
+        valid = run->Next();
+        if (valid) word = run->Word();
+      }
+      else if ((valid = next < words.size())) word = words[next++];
+    }
+  };
+
+  SortedWordSetBuilder out;
+  Cursor a(left), b(right);
+  while (a.valid || (keep_right && b.valid)) {
+    if (!b.valid || (a.valid && a.word < b.word)) { out.Add(a.word); a.Next(); }
+    else if (!a.valid || b.word < a.word) { if (keep_right) out.Add(b.word); b.Next(); }
+    else {                                // In both.
+      if (keep_right) out.Add(a.word);
+      a.Next();
+      b.Next();
+    }
+  }
+  return out.Build();
+}
+
+#endif // #ifndef WORDLANG_WORD_SET_HPP_INCLUDE_
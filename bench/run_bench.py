@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Benchmark the WordLang interpreter hot paths and report JSON.
+
+Generates word corpora of several sizes and word-length distributions (cached
+in bench/data/), writes a small .wl script for each operation, runs every
+script several times and reports per-benchmark latency percentiles, throughput
+(input words per second) and peak RSS of the interpreter process.
+
+Configuration comes from the environment so `make bench` stays a one-liner:
+  BENCH_SIZES   comma-separated corpus sizes in words (default 1000,10000,100000,1000000;
+                suffixes K and M are allowed, e.g. 100M)
+  BENCH_DISTS   comma-separated distributions: short, uniform, long (default all)
+  BENCH_REPS    runs per benchmark (default 5)
+  BENCH_FILTER  only run benchmarks whose name contains this string
+  BENCH_ARGS    extra interpreter arguments (e.g. "--threads 4")
+"""
+
+import json
+import os
+import random
+import subprocess
+import sys
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+DATA_DIR = os.path.join(BENCH_DIR, "data")
+ALPHABET = "abcdefghijklmnopqrstuvwxyz"
+
+# Word-length distributions: name -> function(rng) returning a word length.
+DISTRIBUTIONS = {
+    "short": lambda rng: rng.randint(1, 4),      # Few distinct words, many repeats.
+    "uniform": lambda rng: rng.randint(1, 12),
+    "long": lambda rng: min(64, 6 + int(rng.expovariate(1 / 10))),
+}
+
+
+def parse_size(text):
+    text = text.strip().upper()
+    scale = {"K": 10**3, "M": 10**6}.get(text[-1:], 1)
+    return int(text[:-1] if scale > 1 else text) * scale
+
+
+def corpus_path(dist, size, which):
+    return os.path.join(DATA_DIR, f"{dist}_{size}_{which}.txt")
+
+
+def make_corpus(dist, size, which):
+    """Write `size` random words (one seed per file) unless already cached."""
+    path = corpus_path(dist, size, which)
+    if os.path.exists(path):
+        return path
+    os.makedirs(DATA_DIR, exist_ok=True)
+    rng = random.Random(f"{dist}-{size}-{which}")
+    length = DISTRIBUTIONS[dist]
+    tmp_path = path + ".tmp"
+    with open(tmp_path, "w") as out:
+        batch = []
+        for i in range(size):
+            batch.append("".join(rng.choices(ALPHABET, k=length(rng))))
+            if len(batch) == 10000 or i == size - 1:
+                out.write("\n".join(batch) + "\n")
+                batch = []
+    os.replace(tmp_path, path)
+    return path
+
+
+def needle_list(count, seed):
+    rng = random.Random(seed)
+    return " + ".join(f'"{"".join(rng.choices(ALPHABET, k=rng.randint(2, 3)))}"'
+                      for _ in range(count))
+
+
+def scripts(a, b):
+    """Benchmark name -> (script text, number of input words per corpus file)."""
+    load2 = f'List a = load("{a}");\nList b = load("{b}");\n'
+    chain = " + ".join(["a", "b"] * 32)
+    pipe = " ".join(f'| {"filter" if i % 2 else "filter_out"}("{ALPHABET[i]}{ALPHABET[i+1]}")'
+                    for i in range(16))
+    return {
+        "load": (f'List a = load("{a}");\n', 1),
+        "union": (load2 + "List c = a + b;\n", 2),
+        "difference": (load2 + "List c = a - b;\n", 2),
+        "filter": (f'List a = load("{a}");\nList c = a | filter("ab");\n', 1),
+        "filter_out": (f'List a = load("{a}");\nList c = a | filter_out("e");\n', 1),
+        "filter_many": (f'List a = load("{a}");\nList c = a | filter({needle_list(64, 1)});\n', 1),
+        "expr_chain": (load2 + f"List c = {chain} - b;\n", 2),
+        "filter_chain": (f'List a = load("{a}");\nList c = a {pipe};\n', 1),
+    }
+
+
+def run_once(command):
+    """Run command; return (wall seconds, peak RSS in KiB)."""
+    start = time.perf_counter()
+    proc = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    _, status, usage = os.wait4(proc.pid, 0)
+    elapsed = time.perf_counter() - start
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    if proc.returncode != 0:
+        sys.exit(f"benchmark failed: {' '.join(command)}\n{proc.stderr.read().decode()}")
+    proc.stderr.close()
+    # ru_maxrss is KiB on Linux, bytes on macOS.
+    rss = usage.ru_maxrss // 1024 if sys.platform == "darwin" else usage.ru_maxrss
+    return elapsed, rss
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    pos = (len(ordered) - 1) * fraction
+    low = int(pos)
+    high = min(low + 1, len(ordered) - 1)
+    return ordered[low] + (ordered[high] - ordered[low]) * (pos - low)
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else os.path.join(BENCH_DIR, "..", "WordLang")
+    sizes = [parse_size(s) for s in os.environ.get("BENCH_SIZES", "1000,10000,100000,1000000").split(",")]
+    dists = os.environ.get("BENCH_DISTS", ",".join(DISTRIBUTIONS)).split(",")
+    reps = int(os.environ.get("BENCH_REPS", "5"))
+    name_filter = os.environ.get("BENCH_FILTER", "")
+    extra_args = os.environ.get("BENCH_ARGS", "").split()
+
+    results = []
+    for dist in dists:
+        for size in sizes:
+            a = make_corpus(dist, size, "a")
+            b = make_corpus(dist, size, "b")
+            for name, (text, num_files) in scripts(a, b).items():
+                bench_name = f"{name}/{dist}/{size}"
+                if name_filter not in bench_name:
+                    continue
+                script = os.path.join(DATA_DIR, f"{name}_{dist}_{size}.wl")
+                with open(script, "w") as out:
+                    out.write(text)
+                runs = [run_once([binary, *extra_args, script]) for _ in range(reps)]
+                times = [t for t, _ in runs]
+                median = percentile(times, 0.5)
+                results.append({
+                    "name": bench_name,
+                    "operation": name,
+                    "distribution": dist,
+                    "words": size * num_files,
+                    "reps": reps,
+                    "latency_ms": {
+                        "min": min(times) * 1e3,
+                        "p50": median * 1e3,
+                        "p90": percentile(times, 0.9) * 1e3,
+                        "p99": percentile(times, 0.99) * 1e3,
+                        "max": max(times) * 1e3,
+                    },
+                    "words_per_sec": size * num_files / median if median > 0 else None,
+                    "peak_rss_kib": max(rss for _, rss in runs),
+                })
+                print(f"{bench_name}: {median * 1e3:.1f} ms", file=sys.stderr)
+
+    report = {
+        "binary": os.path.abspath(binary),
+        "args": extra_args,
+        "commit": subprocess.run(["git", "-C", BENCH_DIR, "rev-parse", "--short", "HEAD"],
+                                 capture_output=True, text=True).stdout.strip(),
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+        "results": results,
+    }
+    json.dump(report, sys.stdout, indent=2)
+    print()
+
+
+if __name__ == "__main__":
+    main()
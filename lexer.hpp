@@ -3,31 +3,103 @@
 
 #include <algorithm>
 #include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace emplex {
   // Struct to store information about a found Token
   struct Token {
     int id;                             // Type ID for token
-    std::string lexeme;                 // Sequence matched by token
+    std::string_view lexeme;            // Sequence matched by token (views the input)
     size_t line_id;                     // Line token started on
     operator int() const { return id; } // Auto-convert tokens to IDs
   };
   
+  // A set of input symbols kept as a few ranges, so that a run of them can be
+  // matched 16 bytes at a time.  A set needing more than MAX_RANGES ranges is
+  // left empty (and so never matches).
+  struct SymbolRanges {
+    static constexpr size_t MAX_RANGES = 4;
+    std::array<char, MAX_RANGES> lo{};
+    std::array<char, MAX_RANGES> hi{};
+    size_t count = 0;
+
+    constexpr SymbolRanges() = default;
+    constexpr explicit SymbolRanges(const std::array<bool, 128> & in_set) {
+      for (size_t sym = 0; sym < in_set.size(); ++sym) {
+        if (!in_set[sym]) continue;
+        if (count && hi[count-1] == static_cast<char>(sym - 1)) { hi[count-1] = static_cast<char>(sym); continue; }
+        if (count == MAX_RANGES) { count = 0; return; }
+        lo[count] = hi[count] = static_cast<char>(sym);
+        ++count;
+      }
+    }
+
+    constexpr bool Has(char sym) const {
+      for (size_t i = 0; i < count; ++i) if (sym >= lo[i] && sym <= hi[i]) return true;
+      return false;
+    }
+
+    // Length of the run of symbols in this set at the start of in.
+    size_t MatchRun(std::string_view in) const {
+      if (count == 0) return 0;
+      size_t pos = 0;
+  #ifdef __SSE2__
+      // Signed compares also reject bytes >= 128, which no range contains.
+      for (; pos + 16 <= in.size(); pos += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in.data() + pos));
+        __m128i outside = _mm_set1_epi8(-1);
+        for (size_t i = 0; i < count; ++i) {
+          const __m128i miss = _mm_or_si128(_mm_cmplt_epi8(bytes, _mm_set1_epi8(lo[i])),
+                                            _mm_cmpgt_epi8(bytes, _mm_set1_epi8(hi[i])));
+          outside = _mm_and_si128(outside, miss);
+        }
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(outside));
+        if (mask) return pos + static_cast<size_t>(std::countr_zero(mask));
+      }
+  #endif
+      while (pos < in.size() && Has(in[pos])) ++pos;
+      return pos;
+    }
+  };
+
+  // Number of newlines in text.
+  inline size_t CountNewlines(std::string_view text) {
+    size_t count = 0;
+    size_t pos = 0;
+  #ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; pos + 16 <= text.size(); pos += 16) {
+      const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + pos));
+      count += static_cast<size_t>(std::popcount(static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)))));
+    }
+  #endif
+    return count + static_cast<size_t>(std::count(text.begin() + static_cast<std::ptrdiff_t>(pos), text.end(), '\n'));
+  }
+
   // Deterministic Finite Automaton (DFA) for token recognition.
   class DFA {
   private:
     static constexpr int NUM_SYMBOLS=128;
-    static constexpr int NUM_STATES=50;
+    static constexpr int MIN_INPUT=9;    // Equal to SYMBOL_MIN_INPUT, below.
+    static constexpr int NUM_STATES=63;
     using row_t = std::array<int, NUM_SYMBOLS>;
   
     // DFA transition table
     static constexpr std::array<row_t, NUM_STATES> table = {{
-      /* State 0 */ {-1,-1,1,-1,-1,-1,-1,-1,-1,2,2,2,2,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,-1,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,4,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,6,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,7,5,5,8,5,5,9,5,5,5,10,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
-      /* State 1 */ {-1,-1,1,-1,-1,-1,-1,-1,-1,2,2,2,2,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,-1,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,4,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,6,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,7,5,5,8,5,5,9,5,5,5,10,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 0 */ {-1,-1,1,-1,-1,-1,-1,-1,-1,2,2,2,2,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,-1,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,4,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,6,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,7,5,5,8,5,5,9,5,5,5,10,5,5,50,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 1 */ {-1,-1,1,-1,-1,-1,-1,-1,-1,2,2,2,2,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,-1,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,4,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,6,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,7,5,5,8,5,5,9,5,5,5,10,5,5,50,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
       /* State 2 */ {-1,-1,-1,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
       /* State 3 */ {-1,-1,-1,-1,-1,-1,-1,-1,-1,3,-1,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,47,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,48,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3},
       /* State 4 */ {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,45,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
@@ -36,7 +108,7 @@ namespace emplex {
       /* State 7 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,23,5,5,5,5,5,24,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
       /* State 8 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,21,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
       /* State 9 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,17,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
-      /* State 10 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,12,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 10 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,55,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,12,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
       /* State 11 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
       /* State 12 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,13,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
       /* State 13 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,14,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
@@ -75,29 +147,92 @@ namespace emplex {
       /* State 46 */ {-1,-1,-1,46,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
       /* State 47 */ {-1,-1,-1,47,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
       /* State 48 */ {-1,-1,-1,-1,-1,-1,-1,-1,-1,3,-1,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,49,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,48,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3},
-      /* State 49 */ {-1,-1,-1,47,-1,-1,-1,-1,-1,3,-1,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,47,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,48,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3}
+      /* State 49 */ {-1,-1,-1,47,-1,-1,-1,-1,-1,3,-1,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,47,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,48,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3},
+      /* State 50 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,51,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 51 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,52,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 52 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,54,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 53 */ {-1,-1,-1,53,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
+      /* State 54 */ {-1,-1,-1,53,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 55 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,56,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 56 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,57,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 57 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,58,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 58 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,59,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 59 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,60,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 60 */ {-1,-1,-1,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,62,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
+      /* State 61 */ {-1,-1,-1,61,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
+      /* State 62 */ {-1,-1,-1,61,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1,-1,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,-1,-1,-1,-1,-1},
     }};
+    // Symbols whose columns in the table are identical share a class, so
+    // transitions can be kept in a small table of int8_t states by class.
+    static_assert(NUM_STATES <= INT8_MAX, "DFA states must fit in int8_t");
+    static constexpr std::array<uint8_t, NUM_SYMBOLS> symbol_class = []{
+      std::array<uint8_t, NUM_SYMBOLS> classes{};
+      std::array<size_t, NUM_SYMBOLS> first_sym{};   // First symbol of each class.
+      size_t num_classes = 0;
+      for (size_t sym = 0; sym < NUM_SYMBOLS; ++sym) {
+        size_t id = 0;
+        auto same_column = [&sym](size_t other){
+          for (const row_t & row : table) if (row[sym] != row[other]) return false;
+          return true;
+        };
+        while (id < num_classes && !same_column(first_sym[id])) ++id;
+        if (id == num_classes) first_sym[num_classes++] = sym;
+        classes[sym] = static_cast<uint8_t>(id);
+      }
+      return classes;
+    }();
+    static constexpr size_t NUM_CLASSES =
+      *std::max_element(symbol_class.begin(), symbol_class.end()) + size_t{1};
+    static constexpr auto class_table = []{
+      std::array<std::array<int8_t, NUM_CLASSES>, NUM_STATES> out{};
+      for (size_t state = 0; state < NUM_STATES; ++state) {
+        for (size_t sym = 0; sym < NUM_SYMBOLS; ++sym) {
+          out[state][symbol_class[sym]] = static_cast<int8_t>(table[state][sym]);
+        }
+      }
+      return out;
+    }();
+
+    // For each state, the input symbols that lead straight back to it (other
+    // than newline, which the lexer must see for its end-of-line look-ahead).
+    static constexpr auto loop_symbols = []{
+      std::array<SymbolRanges, NUM_STATES> out{};
+      for (size_t state = 0; state < NUM_STATES; ++state) {
+        std::array<bool, NUM_SYMBOLS> loops{};
+        for (size_t sym = MIN_INPUT; sym < NUM_SYMBOLS; ++sym) {
+          loops[sym] = sym != '\n' && table[state][sym] == static_cast<int>(state);
+        }
+        out[state] = SymbolRanges{loops};
+      }
+      return out;
+    }();
+
     // DFA stop states (0 indicates NOT a stop)
-    static constexpr std::array<int, NUM_STATES> stop_id = {0,0,246,0,0,248,248,248,248,248,248,248,248,248,248,250,250,248,248,254,254,249,249,248,248,248,248,248,248,251,251,248,248,248,253,253,248,248,248,252,252,248,248,255,255,245,245,247,0,247};
+    static constexpr std::array<int, NUM_STATES> stop_id = {0,0,244,0,0,246,246,246,246,246,246,246,246,246,246,249,249,246,246,254,254,247,247,246,246,246,246,246,246,251,251,246,246,246,253,253,246,246,246,252,252,246,246,255,255,243,243,245,0,245,246,246,246,248,248,246,246,246,246,246,246,250,250};
   
   public:
     constexpr static int SYMBOL_START = 2;     ///< Symbol to indicate a start of line.
     constexpr static int SYMBOL_STOP = 3;      ///< Symbol to indicate an end of line.
     constexpr static int SYMBOL_MIN_INPUT = 9; ///< Symbols below this are control symbols.
+    static_assert(MIN_INPUT == SYMBOL_MIN_INPUT);
   
-    static constexpr size_t size() { return 50; }
+    static constexpr size_t size() { return 63; }
     static constexpr int GetStop(int state) {
       return (state >= 0) ? stop_id[static_cast<size_t>(state)] : 0;
     }
     static constexpr int GetNext(int state, int sym) {
       int next_state = -1;
       if (state >= 0 && sym >= 0) {
-        next_state = table[static_cast<size_t>(state)][static_cast<size_t>(sym)];
+        next_state = class_table[static_cast<size_t>(state)][symbol_class[static_cast<size_t>(sym)]];
       }
       // If sym is a control symbol (line begin/end) and not used, keep old state.
       if (sym < SYMBOL_MIN_INPUT && next_state == -1) next_state = state;
       return next_state;
     }
+    // Symbols that keep the DFA in state; see loop_symbols.
+    static constexpr const SymbolRanges & GetLoop(int state) {
+      return loop_symbols[static_cast<size_t>(state)];
+    }
     static int GetNext(int state, const std::string & syms) {
       for (char x : syms) state = GetNext(state, x);
       return state;
@@ -112,23 +247,26 @@ namespace emplex {
   
   class Lexer {
   private:
-    static constexpr int NUM_TOKENS=11;
+    static constexpr int NUM_TOKENS=13;
     static constexpr int ERROR_ID = -1;     ///< Code for unknown token ID.
   
     // -- Current State --
     size_t cur_line = 1;   // Track LINE we are reading in the input.
-    int start_pos = 0;     // Track INDEX for the start of current lexeme.
-    std::string lexeme{};  // Lexeme found for the current token
+    std::ptrdiff_t start_pos = 0;  // Track INDEX for the start of current lexeme.
+    std::string_view lexeme{};     // Lexeme found for the current token
+    std::string source{};          // Input read from a stream; tokens view into it.
     std::string errors{};  // Description of any errors encountered
   
   public:
     static constexpr int ID__EOF_ = 0;
-    static constexpr int ID_COMMENTS = 245;         // Regex: //.*
-    static constexpr int ID_WHITESPACE = 246;       // Regex: \s
-    static constexpr int ID_STRING = 247;           // Regex: \"([^"\n]|\\.)*\"
-    static constexpr int ID_ID = 248;               // Regex: [a-zA-Z_]\w*
-    static constexpr int ID_IN = 249;               // Regex: in
-    static constexpr int ID_PRINT = 250;            // Regex: print
+    static constexpr int ID_COMMENTS = 243;         // Regex: //.*
+    static constexpr int ID_WHITESPACE = 244;       // Regex: \s
+    static constexpr int ID_STRING = 245;           // Regex: \"([^"\n]|\\.)*\"
+    static constexpr int ID_ID = 246;               // Regex: [a-zA-Z_]\w*
+    static constexpr int ID_IN = 247;               // Regex: in
+    static constexpr int ID_SAVE = 248;             // Regex: save
+    static constexpr int ID_PRINT = 249;            // Regex: print
+    static constexpr int ID_PARALLEL = 250;         // Regex: parallel
     static constexpr int ID_FOREACH = 251;          // Regex: foreach
     static constexpr int ID_FILTER_OUT = 252;       // Regex: filter_out
     static constexpr int ID_FILTER = 253;           // Regex: filter
@@ -140,12 +278,14 @@ namespace emplex {
       switch (id) {
       case -1: return "_ERROR_";
       case 0: return "_EOF_";
-      case 245: return "COMMENTS";
-      case 246: return "WHITESPACE";
-      case 247: return "STRING";
-      case 248: return "ID";
-      case 249: return "IN";
-      case 250: return "PRINT";
+      case 243: return "COMMENTS";
+      case 244: return "WHITESPACE";
+      case 245: return "STRING";
+      case 246: return "ID";
+      case 247: return "IN";
+      case 248: return "SAVE";
+      case 249: return "PRINT";
+      case 250: return "PARALLEL";
       case 251: return "FOREACH";
       case 252: return "FILTER_OUT";
       case 253: return "FILTER";
@@ -159,8 +299,8 @@ namespace emplex {
     static constexpr bool IgnoreToken(int id) {
       switch (id) {
       case 0:
-      case 245:
-      case 246:
+      case 243:
+      case 244:
         return true;
       default: return false;
       };
@@ -174,8 +314,8 @@ namespace emplex {
       // If we cannot read in, return an "EOF" token.
       if (start_pos >= std::ssize(in)) return { 0, "", cur_line };
   
-      int cur_pos = start_pos;   // Position in the input that we are actively analyzing
-      int best_pos = start_pos;  // Best look-ahead we've found so far
+      std::ptrdiff_t cur_pos = start_pos;   // Position in the input that we are actively analyzing
+      std::ptrdiff_t best_pos = start_pos;  // Best look-ahead we've found so far
       int cur_state = 0;         // Next state for the DFA analysis
       int cur_stop = 0;          // Current "stop" state (or 0 if we can't stop here)
       int best_stop = -1;        // Best stop state found so far?
@@ -193,6 +333,12 @@ namespace emplex {
         if (next_char < 0) break; // Ignore invalid chars.
         cur_state = DFA::GetNext(cur_state, next_char);
         cur_stop = DFA::GetStop(cur_state);
+        // Take any run of symbols that leave the state unchanged in one step;
+        // no newline is inside the run, so only its end needs the look-ahead.
+        if (cur_state >= 0) {
+          const std::string_view rest = in.substr(static_cast<size_t>(cur_pos));
+          cur_pos += static_cast<std::ptrdiff_t>(DFA::GetLoop(cur_state).MatchRun(rest));
+        }
         if (cur_stop > 0) { best_pos = cur_pos; best_stop = cur_stop; }
         // Look ahead to see if we are at the END OF A LINE that can finish a token.
         if (cur_pos == std::ssize(in) || in[cur_pos] == '\n') {
@@ -210,28 +356,66 @@ namespace emplex {
   
       // Update the line number we are on.
       const size_t out_line = cur_line;
-      cur_line += static_cast<size_t>(std::count(lexeme.begin(),lexeme.end(),'\n'));
+      cur_line += CountNewlines(lexeme);
   
       // Return the token we found.
       return { best_stop, lexeme, out_line };
     }
   
-    // Convert an input string into a vector of tokens.
+    // Skip ahead over any run of symbols that would each be lexed as a
+    // one-symbol ignored token (such as whitespace), counting its newlines.
+    void SkipIgnored(std::string_view in) {
+      static constexpr SymbolRanges skip = []{
+        std::array<bool, 128> skippable{};
+        const int line_start = DFA::GetNext(0, DFA::SYMBOL_START);
+        for (int sym = DFA::SYMBOL_MIN_INPUT; sym < 128; ++sym) {
+          bool ok = true;
+          for (int from : {0, line_start}) {
+            const int state = DFA::GetNext(from, sym);
+            const int eol_stop = DFA::GetStop(DFA::GetNext(state, DFA::SYMBOL_STOP));
+            ok = ok && DFA::GetStop(state) > 0 && IgnoreToken(DFA::GetStop(state)) &&
+                 (eol_stop == 0 || IgnoreToken(eol_stop));
+            for (int next = DFA::SYMBOL_MIN_INPUT; next < 128; ++next) {
+              ok = ok && DFA::GetNext(state, next) < 0;
+            }
+          }
+          skippable[static_cast<size_t>(sym)] = ok;
+        }
+        return SymbolRanges{skippable};
+      }();
+      if (start_pos >= std::ssize(in)) return;
+      const std::string_view run = in.substr(static_cast<size_t>(start_pos));
+      size_t length = skip.MatchRun(run);
+      // A control symbol keeps the DFA's state, so it joins the token before it.
+      if (length && length < run.size() && run[length] >= 0 && run[length] < DFA::SYMBOL_MIN_INPUT) --length;
+      cur_line += CountNewlines(run.substr(0, length));
+      start_pos += static_cast<std::ptrdiff_t>(length);
+    }
+
+    // Restart at the beginning of a new input.
+    void Reset() {
+      start_pos = 0;
+      cur_line = 1;
+    }
+  
+    // Convert an input string into a vector of tokens; lexemes view into `in`.
     std::vector<Token> Tokenize(std::string_view in) {
-      start_pos = 0; // Start processing at beginning of string.
-      cur_line = 1;  // Start processing at the first line of the input.
+      Reset();
       std::vector<Token> out_tokens;
-      while (Token token = NextToken(in)) {
+      while (true) {
+        SkipIgnored(in);
+        Token token = NextToken(in);
+        if (!token) break;
         if (!IgnoreToken(token.id)) out_tokens.push_back(token);
       }
       return out_tokens;
     }
   
-    // Convert an input stream to a string, then tokenize.
+    // Convert an input stream to a string, then tokenize.  Lexemes view into a
+    // copy owned by this lexer, so they are valid until the next Tokenize().
     std::vector<Token> Tokenize(std::istream & is) {
-      return Tokenize(
-        std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>())
-      );
+      source.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+      return Tokenize(source);
     }
   };
 } // End of namespace emplex
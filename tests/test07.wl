@@ -0,0 +1,11 @@
+List my_words = load("tests/TEST_WORDS") + "EXTRA";
+save(my_words | filter("s"), "tests/test07.wls");
+
+// Loading a snapshot gives back exactly the words that were saved.
+List saved = load("tests/test07.wls");
+print(saved);
+print(saved - (my_words | filter("s")));
+
+// Saving over a file that was already loaded; the next load sees the new words.
+save(saved | filter("t"), "tests/test07.wls");
+print(load("tests/test07.wls") | filter_out("e"));
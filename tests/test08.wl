@@ -0,0 +1,23 @@
+List my_words = load("tests/TEST_WORDS");
+List words_with_s = my_words | filter("s");
+
+// The body runs once per word, in sorted order.
+foreach word in words_with_s:
+  print word;
+
+// Loops can build up a value; the loop variable is a one-word list.
+List with_e;
+foreach word in my_words | filter_out("s"): {
+  List found = word | filter("e");
+  with_e = with_e + found;
+}
+print(with_e);
+
+// Nested loops, and a body that reads a variable the loop never changes.
+foreach a in "x" + "y":
+  foreach b in my_words | filter("th"):
+    print(a + b, words_with_s | filter_out("e"));
+
+// A parallel loop cannot change outside variables, and prints in loop order.
+parallel foreach word in my_words:
+  print(word, my_words | filter(word) | filter_out("e"));
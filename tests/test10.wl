@@ -0,0 +1,4 @@
+// A word list that happens to start with the snapshot magic line is still a
+// word list: its header does not describe a snapshot.
+List words = load("tests/MAGIC_WORDS");
+print(words);